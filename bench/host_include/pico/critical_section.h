@@ -0,0 +1,6 @@
+#pragma once
+// Single-threaded stand-in for the SDK critical section (host benchmarks only)
+typedef struct { int unused; } critical_section_t;
+static inline void critical_section_init(critical_section_t *cs) { (void)cs; }
+static inline void critical_section_enter_blocking(critical_section_t *cs) { (void)cs; }
+static inline void critical_section_exit(critical_section_t *cs) { (void)cs; }
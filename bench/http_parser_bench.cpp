@@ -0,0 +1,150 @@
+// Host benchmark for the incremental HTTP request parser shared by the portals.
+// Build: cmake -S . -B build-host -DPICO_CAPTIVE_CONNECT_HOST_BENCH=ON && cmake --build build-host
+#include "http_parser.h"
+#include "bench_clock.h"
+#include <cstdio>
+#include <cstring>
+
+static const char GET_REQ[] =
+    "GET /hotspot-detect.html?x=1 HTTP/1.1\r\n"
+    "Host: captive.apple.com\r\n"
+    "User-Agent: CaptiveNetworkSupport-443.40.1 wispr\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-GB,en;q=0.9\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static const char POST_REQ[] =
+    "POST /save HTTP/1.1\r\n"
+    "Host: 192.168.4.1\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 36\r\n"
+    "Origin: http://192.168.4.1\r\n"
+    "\r\n"
+    "s=HomeNet&p=correct+horse&n=pico-one";
+
+// Feed data in pieces of at most `chunk` bytes, as consecutive pbufs would
+static HttpParseStatus feed_chunked(HttpParser &p, const char *data, size_t len, size_t chunk, size_t *total) {
+    size_t off = 0;
+    HttpParseStatus st = HTTP_PARSE_MORE;
+    while (off < len) {
+        size_t n = len - off < chunk ? len - off : chunk, used;
+        st = http_parser_feed(p, data + off, n, &used);
+        off += used;
+        if (st != HTTP_PARSE_MORE) break;
+    }
+    *total = off;
+    return st;
+}
+
+static bool same_request(const HttpRequest &a, const HttpRequest &b) {
+    return a.method == b.method && a.version_minor == b.version_minor && a.keep_alive == b.keep_alive &&
+           !strcmp(a.path, b.path) && !strcmp(a.query, b.query) && a.content_length == b.content_length &&
+           a.body_len == b.body_len && !memcmp(a.body, b.body, a.body_len);
+}
+
+static bool check_splits(const char *req) {
+    static HttpParser whole, split;
+    size_t len = strlen(req), used;
+    http_parser_init(whole);
+    if (http_parser_feed(whole, req, len, &used) != HTTP_PARSE_DONE || used != len) {
+        printf("FAIL: request not parsed whole\n");
+        return false;
+    }
+    // a split at every offset must give the same result
+    for (size_t cut = 1; cut < len; cut++) {
+        http_parser_init(split);
+        size_t u1, u2;
+        if (http_parser_feed(split, req, cut, &u1) != HTTP_PARSE_MORE || u1 != cut ||
+            http_parser_feed(split, req + cut, len - cut, &u2) != HTTP_PARSE_DONE || u2 != len - cut ||
+            !same_request(whole.req, split.req)) {
+            printf("FAIL: split at %zu\n", cut);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_pipelined() {
+    static HttpParser p;
+    char buf[1024];
+    int len = snprintf(buf, sizeof(buf), "%s%s%s", POST_REQ, GET_REQ, POST_REQ);
+    const char *paths[] = {"/save", "/hotspot-detect.html", "/save"};
+    size_t off = 0;
+    for (const char *path : paths) {
+        size_t used;
+        http_parser_init(p);
+        if (http_parser_feed(p, buf + off, len - off, &used) != HTTP_PARSE_DONE || strcmp(p.req.path, path)) {
+            printf("FAIL: pipelined request at %zu\n", off);
+            return false;
+        }
+        off += used;
+    }
+    if (off != (size_t)len) {
+        printf("FAIL: pipelined requests left %zu bytes\n", len - off);
+        return false;
+    }
+    return true;
+}
+
+struct ErrorCase {
+    const char *req;
+    uint16_t status;
+};
+
+static bool check_errors() {
+    static char long_path[HTTP_MAX_PATH + 32], big_hdr[HTTP_MAX_HEADER_BYTES + 64];
+    snprintf(long_path, sizeof(long_path), "GET /%0*d HTTP/1.1\r\n\r\n", HTTP_MAX_PATH, 0);
+    snprintf(big_hdr, sizeof(big_hdr), "GET / HTTP/1.1\r\nX: %0*d\r\n\r\n", HTTP_MAX_HEADER_BYTES, 0);
+    const ErrorCase cases[] = {
+        {"BREW /pot HTTP/1.1\r\n\r\n", 501},
+        {"get / HTTP/1.1\r\n\r\n", 501},
+        {"GET / HTTP/2.0\r\n\r\n", 505},
+        {"GET /\r\n\r\n", 400},
+        {"POST /save HTTP/1.1\r\nContent-Length: 12x\r\n\r\n", 400},
+        {"POST /save HTTP/1.1\r\nContent-Length: 99999\r\n\r\n", 413},
+        {"POST /save HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", 501},
+        {long_path, 414},
+        {big_hdr, 431},
+    };
+    static HttpParser p;
+    for (const ErrorCase &c : cases) {
+        size_t used;
+        http_parser_init(p);
+        if (http_parser_feed(p, c.req, strlen(c.req), &used) != HTTP_PARSE_ERROR || p.error != c.status) {
+            printf("FAIL: expected %u for \"%.20s...\", got %u\n", c.status, c.req, p.error);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    if (!check_splits(GET_REQ) || !check_splits(POST_REQ) || !check_pipelined() || !check_errors()) return 1;
+    printf("split, pipelined and error cases pass\n\n");
+
+    static HttpParser p;
+    const size_t chunks[] = {4096, 536, 64, 1};
+    const struct { const char *name; const char *req; } reqs[] = {{"GET", GET_REQ}, {"POST", POST_REQ}};
+    printf("%-5s %8s %10s %12s\n", "req", "chunk", "ns/req", "cycles/byte");
+    for (const auto &r : reqs) {
+        size_t len = strlen(r.req);
+        for (size_t chunk : chunks) {
+            const size_t iters = chunk == 1 ? 50000 : 500000;
+            volatile size_t sink = 0;
+            uint64_t t0 = bench_now_ns(), c0 = bench_cycles();
+            for (size_t i = 0; i < iters; i++) {
+                size_t used;
+                http_parser_init(p);
+                feed_chunked(p, r.req, len, chunk, &used);
+                sink = sink + used + p.req.path[1];
+            }
+            uint64_t ns = bench_now_ns() - t0, cyc = bench_cycles() - c0;
+            printf("%-5s %8zu %10.1f", r.name, chunk, (double)ns / iters);
+            if (cyc) printf(" %12.2f", (double)cyc / (iters * len));
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+// Host benchmark for kv_store/creds_store on the memory-mapped flash backend:
+// save/load throughput, modelled interrupt-off time, wear spread and
+// power-fail recovery with torn erases and programs.
+// Build: cmake -S . -B build-host -DPICO_CAPTIVE_CONNECT_HOST_BENCH=ON && cmake --build build-host
+#include "creds_store.h"
+#include "kv_store.h"
+#include "flash_hal.h"
+#include "bench_clock.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#define KEY_COUNTER (KV_USER_KEY_BASE + 0)
+#define KEY_CANARY  (KV_USER_KEY_BASE + 1)
+
+static void print_flash_stats(const char *what, uint32_t ops) {
+    const FlashHalHostStats &st = flash_hal_host_stats();
+    printf("%s: erases=%u programs=%u pages=%u modelled busy=%.2f ms/save max irq-off=%u us\n",
+           what, st.erases, st.programs, st.pages_programmed,
+           ops ? st.busy_us / 1000.0 / ops : 0.0, st.max_irq_off_us);
+}
+
+static void bench_saves(uint32_t n) {
+    DeviceCreds c{};
+    strcpy(c.ssid, "bench-net");
+    strcpy(c.wifi_pass, "bench-pass");
+    strcpy(c.mqtt_host, "broker.example.com");
+    c.mqtt_port = 1883;
+    creds_save(c);
+
+    flash_hal_host_reset_stats();
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        snprintf(c.hostname, sizeof(c.hostname), "pico-%u", (unsigned)i);
+        if (!creds_save(c)) {
+            printf("save %u failed\n", (unsigned)i);
+            exit(1);
+        }
+    }
+    uint64_t t1 = bench_now_ns();
+    printf("creds_save x%u: %.2f us/save host CPU\n", (unsigned)n, (t1 - t0) / 1000.0 / n);
+    print_flash_stats("  flash", n);
+    printf("  saves that needed a sector erase: %.1f%%, the rest held IRQs off for one page program\n",
+           100.0 * flash_hal_host_stats().erases / n);
+}
+
+// Replay the previous layout on a scratch region: every save erased the one
+// sector and programmed the blob under a single save_and_disable_interrupts()
+static void bench_erase_per_save(const char *path, uint32_t n) {
+    char scratch[256];
+    snprintf(scratch, sizeof(scratch), "%s.old", path);
+    unlink(scratch);
+    if (!flash_hal_host_open(scratch)) exit(1);
+    static uint8_t blob[(sizeof(DeviceCreds) + 8 + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE];
+    memset(blob, 0xA5, sizeof(blob));
+
+    flash_hal_host_reset_stats();
+    for (uint32_t i = 0; i < n; i++) {
+        flash_hal_erase(0);
+        flash_hal_program(0, blob, sizeof(blob));
+    }
+    const FlashHalHostStats &st = flash_hal_host_stats();
+    printf("erase-per-save layout x%u: erases=%u pages=%u modelled busy=%.2f ms/save, all of it irq-off\n",
+           (unsigned)n, st.erases, st.pages_programmed, st.busy_us / 1000.0 / n);
+
+    flash_hal_host_close();
+    unlink(scratch);
+    if (!flash_hal_host_open(path)) exit(1);
+}
+
+static void bench_load(uint32_t n) {
+    uint64_t t0 = bench_now_ns();
+    size_t keys = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        kv_unmount();
+        keys += kv_count();     // full scan + replay, i.e. a boot
+    }
+    uint64_t t1 = bench_now_ns();
+    printf("mount (boot) x%u: %.2f us/mount, %zu keys\n", (unsigned)n, (t1 - t0) / 1000.0 / n, keys / n);
+
+    char buf[64];
+    t0 = bench_now_ns();
+    for (uint32_t i = 0; i < n * 100; i++) kv_get(0x0003, buf, sizeof(buf));
+    t1 = bench_now_ns();
+    printf("kv_get x%u: %.3f us/get\n", (unsigned)n * 100, (t1 - t0) / 1000.0 / (n * 100));
+}
+
+static void print_wear() {
+    const FlashHalHostStats &st = flash_hal_host_stats();
+    uint32_t lo = UINT32_MAX, hi = 0;
+    for (uint32_t e : st.sector_erases) {
+        if (e < lo) lo = e;
+        if (e > hi) hi = e;
+    }
+    printf("wear: per-sector erases min=%u max=%u over %u sectors\n",
+           (unsigned)lo, (unsigned)hi, (unsigned)(CREDS_FLASH_SIZE / FLASH_SECTOR_SIZE));
+}
+
+// Cut power at a random point of a random write, reboot, and check the store
+// holds either the old or the new value and nothing else was lost.
+static bool bench_power_fail(uint32_t trials) {
+    kv_set_u32(KEY_CANARY, 0xC0FFEE);
+    uint32_t committed = 0;
+    kv_set_u32(KEY_COUNTER, committed);
+
+    uint32_t kept_old = 0, got_new = 0, bad = 0, cuts = 0;
+    for (uint32_t t = 0; t < trials; t++) {
+        flash_hal_host_fail_after(1 + rand() % 3, rand() % (2 * FLASH_PAGE_SIZE));
+        for (int i = 0; i < 4; i++) {
+            uint32_t next = committed + 1;
+            if (kv_set_u32(KEY_COUNTER, next)) {
+                committed = next;
+                continue;
+            }
+            // power lost: reboot and check what survived
+            cuts++;
+            flash_hal_host_power_cycle();
+            kv_unmount();
+            uint32_t v = 0, canary = 0;
+            bool ok = kv_get_u32(KEY_COUNTER, v) && kv_get_u32(KEY_CANARY, canary) && canary == 0xC0FFEE;
+            if (ok && v == committed) kept_old++;
+            else if (ok && v == next) { got_new++; committed = next; }
+            else {
+                bad++;
+                printf("  trial %u: counter=%u canary=%x (expected %u or %u)\n",
+                       (unsigned)t, (unsigned)v, (unsigned)canary, (unsigned)committed, (unsigned)next);
+                kv_set_u32(KEY_CANARY, 0xC0FFEE);
+                kv_set_u32(KEY_COUNTER, committed);
+            }
+            break;
+        }
+        flash_hal_host_power_cycle();
+    }
+    printf("power-fail: %u cuts, %u kept old value, %u kept new value, %u corrupt\n",
+           (unsigned)cuts, (unsigned)kept_old, (unsigned)got_new, (unsigned)bad);
+    return bad == 0;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "kv_bench.flash";
+    unlink(path);
+    if (!flash_hal_host_open(path)) return 1;
+    srand(1);
+
+    bench_saves(5000);
+    bench_load(200);
+    print_wear();
+    bench_erase_per_save(path, 5000);
+    bool ok = bench_power_fail(5000);
+
+    flash_hal_host_close();
+    unlink(path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+# ====================================================================================
+# Embed the files in web/ as gzip'd C arrays with ready-made response headers.
+# Script mode: cmake -DWEB_DIR=<dir> -DOUTPUT=<file.cpp> -P embed_assets.cmake
+# ====================================================================================
+
+if (NOT WEB_DIR OR NOT OUTPUT)
+    message(FATAL_ERROR "embed_assets: WEB_DIR and OUTPUT are required")
+endif()
+
+find_program(GZIP_EXECUTABLE gzip)
+
+file(GLOB assets RELATIVE ${WEB_DIR} ${WEB_DIR}/*)
+list(SORT assets)
+
+# 16 bytes per line (CMake regexes have no {n})
+set(row "")
+foreach(i RANGE 15)
+    string(APPEND row "0x..,")
+endforeach()
+
+set(tmp ${OUTPUT}.gz)
+set(data "")
+set(table "")
+set(count 0)
+foreach(name ${assets})
+    set(src ${WEB_DIR}/${name})
+    if (IS_DIRECTORY ${src})
+        continue()
+    endif()
+
+    # No name or timestamp in the gzip header, so the output only changes with the content
+    if (GZIP_EXECUTABLE)
+        execute_process(COMMAND ${GZIP_EXECUTABLE} -9 -n -c ${src} OUTPUT_FILE ${tmp} RESULT_VARIABLE rc)
+        if (rc)
+            message(FATAL_ERROR "embed_assets: gzip failed on ${name}")
+        endif()
+    elseif (CMAKE_VERSION VERSION_GREATER_EQUAL 3.18)
+        file(ARCHIVE_CREATE OUTPUT ${tmp} PATHS ${src} FORMAT raw COMPRESSION GZip)
+    else()
+        message(FATAL_ERROR "embed_assets: needs gzip or CMake >= 3.18")
+    endif()
+
+    file(READ ${tmp} hex HEX)
+    string(LENGTH "${hex}" hex_len)
+    math(EXPR len "${hex_len} / 2")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    string(REGEX REPLACE "(${row})" "\\1\n    " bytes "${bytes}")
+
+    # ETag from the uncompressed content
+    file(SHA256 ${src} hash)
+    string(SUBSTRING ${hash} 0 16 etag)
+
+    if (name MATCHES "\\.html?$")
+        set(type "text/html; charset=utf-8")
+    elseif (name MATCHES "\\.css$")
+        set(type "text/css")
+    elseif (name MATCHES "\\.js$")
+        set(type "application/javascript")
+    elseif (name MATCHES "\\.json$")
+        set(type "application/json")
+    elseif (name MATCHES "\\.svg$")
+        set(type "image/svg+xml")
+    elseif (name MATCHES "\\.png$")
+        set(type "image/png")
+    elseif (name MATCHES "\\.ico$")
+        set(type "image/x-icon")
+    else()
+        set(type "application/octet-stream")
+    endif()
+
+    string(APPEND data
+        "// ${name}\n"
+        "static const uint8_t asset_${count}[${len}] = {\n    ${bytes}\n};\n"
+        "static const char header_${count}[] =\n"
+        "    \"HTTP/1.1 200 OK\\r\\n\"\n"
+        "    \"Content-Type: ${type}\\r\\n\"\n"
+        "    \"Content-Encoding: gzip\\r\\n\"\n"
+        "    \"Vary: Accept-Encoding\\r\\n\"\n"
+        "    \"Content-Length: ${len}\\r\\n\"\n"
+        "    \"ETag: \\\"${etag}\\\"\\r\\n\"\n"
+        "    \"Cache-Control: no-cache\\r\\n\";\n\n")
+    string(APPEND table
+        "    {\"/${name}\", asset_${count}, sizeof(asset_${count}), header_${count}, sizeof(header_${count}) - 1, \"\\\"${etag}\\\"\"},\n")
+    math(EXPR count "${count} + 1")
+endforeach()
+file(REMOVE ${tmp})
+
+if (count EQUAL 0)
+    message(FATAL_ERROR "embed_assets: no files in ${WEB_DIR}")
+endif()
+
+file(WRITE ${OUTPUT}
+    "// Generated by cmake/embed_assets.cmake from web/, do not edit\n"
+    "#include \"web_assets.h\"\n\n"
+    "${data}"
+    "const WebAsset web_assets[] = {\n${table}};\n\n"
+    "const unsigned web_asset_count = ${count};\n")
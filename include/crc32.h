@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3 / zlib). Every backend gives identical results; the one
+// behind crc32_update() is picked at compile time with CRC32_BACKEND.
+#define CRC32_BACKEND_BITWISE 0    // no table, 8 shifts per byte
+#define CRC32_BACKEND_TABLE   1    // 1 KB table, one lookup per byte
+#define CRC32_BACKEND_SLICE8  2    // 8 KB of tables, 8 bytes per step
+#define CRC32_BACKEND_DMA     3    // RP2040/RP2350 DMA sniffer, table below CRC32_DMA_MIN_LEN
+
+#ifndef CRC32_BACKEND
+#define CRC32_BACKEND CRC32_BACKEND_TABLE
+#endif
+
+#ifndef CRC32_DMA_MIN_LEN
+// below this the channel setup costs more than the table walk
+#define CRC32_DMA_MIN_LEN 64
+#endif
+
+// Start with crc = 0, pass the previous result to continue over more data
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+static inline uint32_t crc32(const void *data, size_t len) {
+    return crc32_update(0, data, len);
+}
+
+// Individual backends (exposed for the host benchmark)
+uint32_t crc32_update_bitwise(uint32_t crc, const void *data, size_t len);
+uint32_t crc32_update_table(uint32_t crc, const void *data, size_t len);
+uint32_t crc32_update_slice8(uint32_t crc, const void *data, size_t len);
+#if CRC32_BACKEND == CRC32_BACKEND_DMA
+uint32_t crc32_update_dma(uint32_t crc, const void *data, size_t len);
+#endif
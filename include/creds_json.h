@@ -0,0 +1,14 @@
+#pragma once
+#include "creds_store.h"
+#include "json.h"
+
+// DeviceCreds as JSON for the portals' /api/config:
+//   {"ssid":..,"wifi_pass":..,"hostname":..,"mqtt_host":..,"mqtt_port":..,
+//    "mqtt_user":..,"mqtt_pass":..,"mqtt_topic":..}
+// Passwords are never written back out, only whether they are set.
+
+void creds_json_write(JsonWriter &w, const DeviceCreds &c);
+
+// Apply the members of a JSON object onto c. All or nothing: on error c is
+// untouched and err names the offending member. Returns 0 or an HTTP status.
+int creds_json_apply(DeviceCreds &c, const char *json, size_t len, char *err, size_t err_size);
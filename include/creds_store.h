@@ -34,6 +34,70 @@ struct DeviceCreds{
 
 };
 
+#ifndef CREDS_MAX_SUBSCRIBERS
+#define CREDS_MAX_SUBSCRIBERS 4
+#endif
+
+#ifndef CREDS_ASYNC_MAX_WAITERS
+#define CREDS_ASYNC_MAX_WAITERS 4
+#endif
+
+// Flash is only read on first use; loads after that copy from a RAM mirror
 bool creds_load(DeviceCreds &out);
 bool creds_save(const DeviceCreds &in, bool mark_dirty = false);
-void creds_clear();
\ No newline at end of file
+void creds_clear();
+
+// Copy of the stored creds, or of a queued write (zeroed if nothing is
+// stored). Taken under the queue lock, so lwIP callbacks never see a record
+// that net_task() is halfway through replacing.
+DeviceCreds creds_get();
+
+// Bumped on every successful save/clear
+uint32_t creds_generation();
+
+// Called after every successful save/clear with the new contents
+typedef void (*creds_change_cb)(const DeviceCreds &c, uint32_t generation, void *arg);
+bool creds_subscribe(creds_change_cb cb, void *arg);
+void creds_unsubscribe(creds_change_cb cb, void *arg);
+
+// Queue a save for creds_service() (driven by net_task()). Safe to call from
+// lwIP callbacks: nothing touches flash until the service runs. A newer request
+// replaces a queued one; every callback still fires with the commit result.
+// Returns false if the callback table is full.
+typedef void (*creds_save_cb)(bool ok, void *arg);
+bool creds_save_async(const DeviceCreds &in, bool mark_dirty = false,
+                      creds_save_cb cb = nullptr, void *arg = nullptr);
+
+// Last address the MQTT broker was reached at, tied to the host name it was
+// resolved for, so a reboot can connect before DNS answers. The setter is
+// queued like creds_save_async() and only reaches flash if the value changed.
+bool creds_broker_addr(const char *host, uint32_t &addr);
+void creds_set_broker_addr(const char *host, uint32_t addr);
+
+// Where the last STA connection landed, tied to the SSID it was made to, so
+// the next boot can join that AP directly and ask for the same lease. Queued
+// like creds_set_broker_addr().
+struct WifiLinkCache {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t auth;              // CYW43_AUTH_* the join used
+    uint32_t ip;                // addresses as in ip4_addr_t
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+    uint32_t lease_left_s;      // lease time still left when this was written
+};
+bool creds_link_cache(const char *ssid, WifiLinkCache &out);
+void creds_set_link_cache(const char *ssid, const WifiLinkCache &c);
+
+// Commit the queued write, if any (flash_safe_execute, so the other core is parked)
+void creds_service();
+bool creds_save_pending();
+
+struct CredsStats {
+    uint32_t queued;      // creds_save_async() requests accepted
+    uint32_t coalesced;   // requests that replaced a still-queued one
+    uint32_t committed;   // records written (sync and async)
+    uint32_t failed;      // writes that did not reach flash
+};
+CredsStats creds_stats();
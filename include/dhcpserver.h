@@ -4,18 +4,45 @@
 #include "lwip/ip_addr.h"
 
 #define DHCPS_BASE_IP (16)
-#define DHCPS_MAX_IP (8)
+
+#ifndef DHCPS_MAX_IP
+// number of leases, handed out from DHCPS_BASE_IP up
+#define DHCPS_MAX_IP (32)
+#endif
+
+#ifndef DHCPS_HASH_BUCKETS
+// MAC lookup buckets, power of two
+#define DHCPS_HASH_BUCKETS (16)
+#endif
+
+#if DHCPS_BASE_IP + DHCPS_MAX_IP > 255
+#error "DHCPS_MAX_IP does not fit in the /24 after DHCPS_BASE_IP"
+#endif
+
+#define DHCPS_NO_LEASE (0xff)
+
+#define DHCPS_CAPTIVE_URI_MAX (64)
+
+// room for the fixed BOOTP fields plus our options
+#define DHCPS_REPLY_MAX (240 + 128)
 
 typedef struct _dhcp_server_lease_t {
     uint8_t mac[6];
-    uint16_t expiry;
+    uint8_t state;      // DHCPS_LEASE_xxx in dhcpserver.c
+    uint8_t next;       // next lease in the hash chain or free list
+    uint32_t expiry;    // cyw43_hal_ticks_ms() deadline
 } dhcp_server_lease_t;
 
 typedef struct _dhcp_server_t {
     ip_addr_t ip;
     ip_addr_t nm;
     dhcp_server_lease_t lease[DHCPS_MAX_IP];
+    uint8_t bucket[DHCPS_HASH_BUCKETS];     // first lease of each MAC hash chain
+    uint8_t free_head;                      // unused leases
     struct udp_pcb *udp;
+    char captive_uri[DHCPS_CAPTIVE_URI_MAX]; // option 114, empty = not sent
+    struct pbuf *reply;                     // preallocated, reused for every answer
+    void *reply_payload;
 } dhcp_server_t;
 
 #ifdef __cplusplus
@@ -25,6 +52,9 @@ extern "C" {
 void dhcp_server_init(dhcp_server_t *d, ip_addr_t *ip, ip_addr_t *nm);
 void dhcp_server_deinit(dhcp_server_t *d);
 
+// Advertise the captive portal API (RFC 8910 option 114) in OFFER/ACK; call after init
+void dhcp_server_set_captive_uri(dhcp_server_t *d, const char *uri);
+
 #ifdef __cplusplus
 }
 #endif
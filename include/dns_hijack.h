@@ -1,5 +1,24 @@
 #pragma once
 #include "lwip/ip4_addr.h"
+#include <stdint.h>
 
 void dns_hijack_start(ip4_addr_t ap_ip);
 void dns_hijack_stop();
+
+struct DnsHijackStats {
+    uint32_t queries;
+    uint32_t replies_inplace;   // written over the received query
+    uint32_t replies_pool;      // from the preallocated response buffers
+    uint32_t replies_alloc;     // pool busy, fresh PBUF_RAM
+    uint32_t dropped_invalid;   // runt or not a query
+    uint32_t dropped_nomem;     // no buffer to answer from
+    uint32_t dropped_ratelimit; // source over its token bucket
+    uint32_t rl_evictions;      // rate limit slots reclaimed for a new source
+    uint32_t send_errors;
+};
+
+const DnsHijackStats &dns_hijack_stats();
+
+// Per-client token bucket: burst queries back to back, refilled at per_second
+// (0 disables limiting). Defaults are DNS_RL_BURST / DNS_RL_RATE.
+void dns_hijack_set_rate_limit(uint32_t burst, uint32_t per_second);
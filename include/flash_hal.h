@@ -0,0 +1,64 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Flash access used by kv_store. Offsets are relative to the start of the
+// reserved region. On the Pico this maps to XIP reads and flash_safe_execute()
+// erase/program; host builds (FLASH_HAL_HOST) use a memory-mapped file that
+// models NOR semantics, timing and wear for benchmarks.
+
+#ifdef FLASH_HAL_HOST
+#define FLASH_SECTOR_SIZE 4096u
+#define FLASH_PAGE_SIZE 256u
+#else
+#include "hardware/flash.h"
+#endif
+
+#ifndef CREDS_FLASH_SIZE
+// size of the region reserved for the store (must be whole sectors)
+#define CREDS_FLASH_SIZE (64*1024)
+#endif
+
+#ifndef CREDS_FLASH_OFFSET
+// reserve last 64KB (adjust if you already use it)
+#define CREDS_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - CREDS_FLASH_SIZE)
+#endif
+
+// Memory-mapped view of the region
+const uint8_t *flash_hal_ptr(uint32_t off);
+
+// Erase one FLASH_SECTOR_SIZE sector (off sector aligned)
+bool flash_hal_erase(uint32_t off);
+
+// Program whole pages (off and len FLASH_PAGE_SIZE aligned); bits only go 1 -> 0
+bool flash_hal_program(uint32_t off, const uint8_t *data, uint32_t len);
+
+#ifdef FLASH_HAL_HOST
+
+// Host backend controls (bench/)
+struct FlashHalHostStats {
+    uint32_t erases;
+    uint32_t programs;          // program calls
+    uint32_t pages_programmed;
+    uint64_t busy_us;           // modelled time spent in erase/program
+    uint32_t max_irq_off_us;    // longest single operation (IRQs are off for it on the device)
+    uint32_t sector_erases[CREDS_FLASH_SIZE / FLASH_SECTOR_SIZE];
+};
+
+// Map (creating and erasing if needed) a region-sized file
+bool flash_hal_host_open(const char *path);
+void flash_hal_host_close();
+
+// Modelled latencies, defaults are typical QSPI NOR figures
+void flash_hal_host_set_timing(uint32_t erase_us, uint32_t page_program_us);
+
+// Power fails during the nth erase/program from now (1 = next). A program
+// keeps only the first torn_bytes bytes, an erase leaves the sector half done.
+// Every later operation fails until flash_hal_host_power_cycle().
+void flash_hal_host_fail_after(uint32_t nth_op, uint32_t torn_bytes);
+void flash_hal_host_power_cycle();
+
+const FlashHalHostStats &flash_hal_host_stats();
+void flash_hal_host_reset_stats();
+
+#endif
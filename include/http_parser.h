@@ -0,0 +1,76 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental HTTP/1.x request parser. Bytes are fed as they arrive (one pbuf
+// at a time), so a request may be split anywhere. Only what the portals use is
+// kept: method, path, query, a few headers and a bounded Content-Length body.
+// No lwIP dependency, so it builds on the host for bench/.
+
+#ifndef HTTP_MAX_PATH
+#define HTTP_MAX_PATH 96
+#endif
+
+#ifndef HTTP_MAX_QUERY
+#define HTTP_MAX_QUERY 64
+#endif
+
+#ifndef HTTP_MAX_BODY
+// largest form/JSON body accepted, longer ones get 413
+#define HTTP_MAX_BODY 640
+#endif
+
+#ifndef HTTP_MAX_HEADER_BYTES
+// request line + headers, longer ones get 431
+#define HTTP_MAX_HEADER_BYTES 4096
+#endif
+
+#define HTTP_MAX_ETAG 48
+
+enum HttpMethod : uint8_t {
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_DELETE,
+    HTTP_OPTIONS,
+};
+
+struct HttpRequest {
+    HttpMethod method;
+    uint8_t version_minor;          // HTTP/1.x
+    bool keep_alive;                // from the version and Connection header
+    char path[HTTP_MAX_PATH];       // without the query
+    char query[HTTP_MAX_QUERY];
+    char if_none_match[HTTP_MAX_ETAG];
+    bool accepts_gzip;              // Accept-Encoding lists gzip (or *) with q > 0
+    uint32_t content_length;
+    uint16_t body_len;
+    char body[HTTP_MAX_BODY + 1];   // NUL-terminated
+};
+
+enum HttpParseStatus : uint8_t {
+    HTTP_PARSE_MORE,    // everything consumed, request not complete yet
+    HTTP_PARSE_DONE,    // request complete; bytes after *used belong to the next one
+    HTTP_PARSE_ERROR,   // answer with HttpParser::error and close
+};
+
+struct HttpParser {
+    uint8_t state;
+    uint8_t header;                 // header whose value is being collected
+    uint16_t pos;                   // fill level of the current token
+    uint16_t header_bytes;
+    uint16_t error;                 // HTTP status for HTTP_PARSE_ERROR
+    bool chunked;
+    char token[24];                 // method, version or lower-cased header name
+    char value[HTTP_MAX_ETAG];
+    HttpRequest req;
+};
+
+void http_parser_init(HttpParser &p);
+
+// Consume up to len bytes; *used tells how many were taken
+HttpParseStatus http_parser_feed(HttpParser &p, const char *data, size_t len, size_t *used);
+
+const char *http_method_name(HttpMethod m);
@@ -1,3 +1,11 @@
 #pragma once
 
-void http_portal_start();
\ No newline at end of file
+// RFC 8908 captive portal API. Served over plain HTTP, so DHCP option 114 only
+// points at it when DHCPS_CAPTIVE_URI says so (see README).
+#define HTTP_PORTAL_CAPTIVE_API_PATH "/captive-portal/api"
+
+void http_portal_start();
+void http_portal_stop();
+
+// Connection and per-route counters, printed
+void http_portal_print_stats();
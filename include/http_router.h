@@ -0,0 +1,48 @@
+#pragma once
+#include "http_server.h"
+
+// Route tables are constant arrays sorted by path, checked at compile time,
+// and searched by bisection. Each router counts hits per route.
+
+#define HTTP_M(m) (1u << (m))
+#define HTTP_M_GET (HTTP_M(HTTP_GET) | HTTP_M(HTTP_HEAD))
+
+struct HttpRoute {
+    const char *path;
+    uint8_t methods;            // HTTP_M() mask
+    http_handler_fn fn;
+};
+
+struct HttpRouter {
+    const char *name;
+    const HttpRoute *routes;
+    uint16_t count;
+    uint32_t *hits;             // per route, then one for the fallback
+    http_handler_fn fallback;   // no route matched the path
+};
+
+constexpr int http_path_cmp(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+template <size_t N>
+constexpr bool http_routes_sorted(const HttpRoute (&routes)[N]) {
+    for (size_t i = 1; i < N; i++) {
+        if (http_path_cmp(routes[i - 1].path, routes[i].path) >= 0) return false;
+    }
+    return true;
+}
+
+#define HTTP_ROUTER(var, name, routes, fallback)                                        \
+    static_assert(http_routes_sorted(routes), #routes " must be sorted by path");      \
+    static uint32_t var##_hits[sizeof(routes) / sizeof(routes[0]) + 1];                \
+    static const HttpRouter var = {name, routes, sizeof(routes) / sizeof(routes[0]), var##_hits, fallback}
+
+// Dispatch a request; a known path with the wrong method gets 405
+void http_route(const HttpRouter &r, HttpConn *c, const HttpRequest &req);
+
+void http_router_print_stats(const HttpRouter &r);
@@ -0,0 +1,135 @@
+#pragma once
+#include "lwip/tcp.h"
+#include "http_parser.h"
+#include "http_template.h"
+#include "json.h"
+#include "web_assets.h"
+
+// Connection handling shared by the AP and STA portals: a fixed pool of
+// persistent connections, each with its own incremental parser fed straight
+// from the received pbuf chain. Pipelined requests are answered in order as
+// send buffer frees up. The portal only supplies a request handler.
+
+#ifndef HTTP_MAX_CONNS
+#define HTTP_MAX_CONNS 4
+#endif
+
+#ifndef HTTP_IDLE_TIMEOUT_S
+// keep-alive connections with no traffic for this long are closed
+#define HTTP_IDLE_TIMEOUT_S 15
+#endif
+
+#ifndef HTTP_MAX_SHED
+// connections over the cap still being answered 503 at once; more are reset
+#define HTTP_MAX_SHED 2
+#endif
+
+#ifndef HTTP_RX_HOLD_MAX
+// unparsed input held per connection before further segments are refused
+#define HTTP_RX_HOLD_MAX (2 * TCP_MSS)
+#endif
+
+#ifndef HTTP_RX_BUDGET
+// same, summed over all connections (pbufs come from the shared pool)
+#define HTTP_RX_BUDGET (4 * TCP_MSS)
+#endif
+
+#ifndef HTTP_CHUNK_MAX
+// largest piece of a streamed body rendered at once (on the stack)
+#define HTTP_CHUNK_MAX 384
+#endif
+#define HTTP_CHUNK_MIN 64
+
+#ifndef HTTP_RESPONSE_ROOM
+// send buffer needed before the next pipelined request is answered
+#define HTTP_RESPONSE_ROOM (2 * TCP_MSS)
+#endif
+
+struct HttpServer;
+struct HttpConn;
+
+// Produces the next piece of a streamed body into buf (at most room bytes);
+// returns 0 once the body is complete, or HTTP_STREAM_IDLE to send nothing
+// for now and be called again on the next ACK or http_stream_kick()
+typedef size_t (*http_stream_fn)(HttpConn *c, char *buf, size_t room);
+#define HTTP_STREAM_IDLE ((size_t)-1)
+
+struct HttpConn {
+    struct tcp_pcb *pcb;        // nullptr = free slot
+    HttpServer *server;
+    struct pbuf *rx;            // received but not yet parsed (pipelined requests)
+    const uint8_t *tx;          // flash body still to be queued
+    uint32_t tx_len;
+    http_stream_fn stream;      // body still being produced
+    uint32_t stream_pos;        // free for the stream fn, zeroed per response
+    bool chunked;
+    TplCursor tpl;              // state of a templated body
+    uint8_t idle_s;             // seconds without traffic
+    bool closing;               // last response queued, close once it is acked
+    HttpParser parser;
+};
+
+// Called once per complete request; must queue exactly one response
+typedef void (*http_handler_fn)(HttpConn *c, const HttpRequest &req);
+
+struct HttpServerStats {
+    uint32_t accepted;
+    uint32_t shed;              // over the cap: answered 503 (or reset)
+    uint32_t evicted;           // idle keep-alive closed to admit a new client
+    uint32_t reaped_idle;
+    uint32_t reaped_stalled;    // timed out with a response or input pending
+    uint32_t rx_throttled;      // segments refused over the input budget
+    uint16_t active;
+    uint16_t peak;
+};
+
+struct HttpServer {
+    const char *name;           // log tag
+    http_handler_fn handler;
+    struct tcp_pcb *listen_pcb;
+    HttpServerStats stats;
+};
+
+bool http_server_start(HttpServer &s, const ip_addr_t *addr, uint16_t port);
+// Closes the listener and every connection of this server
+void http_server_stop(HttpServer &s);
+
+// Bytes a connection holds: unparsed input plus unacked/unsent output
+uint32_t http_conn_mem(const HttpConn &c);
+// Slot of c in the connection pool, 0 .. HTTP_MAX_CONNS-1, for per-connection
+// state kept by a handler
+uint8_t http_conn_index(const HttpConn *c);
+void http_server_print_stats(const HttpServer &s);
+
+// Queue a complete response. The body is copied into the send queue. The
+// connection stays open for the next request if the client asked for it.
+bool http_send_response(HttpConn *c, int status, const char *content_type,
+                        const void *body, size_t len, const char *extra_headers = nullptr);
+
+// Embedded asset, or 304 if the client's If-None-Match still matches, or 406
+// if it doesn't accept gzip. The body is sent from flash as the send buffer
+// drains.
+bool http_send_asset(HttpConn *c, const WebAsset &a);
+
+// Body produced piecewise as send buffer frees up, chunked for HTTP/1.1
+bool http_send_stream(HttpConn *c, int status, const char *content_type,
+                      http_stream_fn fn, const char *extra_headers = nullptr);
+
+// Offer every connection of s streaming with fn a chance to send, e.g. when
+// an event stream has news. Returns how many such streams are open.
+uint16_t http_stream_kick(HttpServer &s, http_stream_fn fn);
+uint16_t http_stream_count(const HttpServer &s, http_stream_fn fn);
+
+// Templated page, field values HTML-escaped; ctx is passed to value()
+bool http_send_template(HttpConn *c, int status, const char *content_type,
+                        const TplPart *parts, tpl_value_fn value, const void *ctx);
+
+// Plain-text response with the status text as body
+bool http_send_status(HttpConn *c, int status);
+
+// Document built with a JsonWriter (500 if it overflowed), not cacheable
+bool http_send_json(HttpConn *c, int status, const JsonWriter &w);
+// {"error":message}, or the status text without a message
+bool http_send_json_error(HttpConn *c, int status, const char *message);
+
+const char *http_status_text(int status);
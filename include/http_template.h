@@ -0,0 +1,37 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Chunk-based page templates. A template is a constant array of literal
+// fragments and field references, rendered a send buffer's worth at a time;
+// the cursor remembers where to resume. Field values are fetched from a
+// callback on each pass and HTML-escaped as they are copied out, so a page
+// needs no more RAM than the chunk being written.
+
+#define TPL_LITERAL 0xfe
+#define TPL_DONE    0xff
+
+struct TplPart {
+    const char *text;           // literal, or nullptr for a field
+    uint16_t len;
+    uint8_t field;              // field id, or TPL_LITERAL / TPL_DONE
+};
+
+#define TPL_TEXT(s)   {s, sizeof(s) - 1, TPL_LITERAL}
+#define TPL_FIELD(id) {nullptr, 0, (uint8_t)(id)}
+#define TPL_END       {nullptr, 0, TPL_DONE}
+
+// Value of a field; may format into scratch and return it
+typedef const char *(*tpl_value_fn)(const void *ctx, uint8_t field, char *scratch, size_t size);
+
+struct TplCursor {
+    const TplPart *part;
+    uint16_t off;               // into the literal, or the unescaped value
+    tpl_value_fn value;
+    const void *ctx;
+};
+
+void tpl_begin(TplCursor &t, const TplPart *parts, tpl_value_fn value, const void *ctx);
+
+// Render up to room bytes (room >= 6, the longest escape); 0 once complete
+size_t tpl_render(TplCursor &t, char *buf, size_t room);
@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal JSON for the portals' REST endpoints, with no allocation. The writer
+// appends to a caller buffer and only records overflow; the reader walks the
+// members of one flat object in place, unescaping strings into caller buffers.
+
+struct JsonWriter {
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;              // output was cut; len stays at the last fit
+    bool comma;                 // a value precedes at the current level
+};
+
+void json_init(JsonWriter &w, char *buf, size_t size);
+
+// key is nullptr inside arrays and for the top-level value
+void json_object_begin(JsonWriter &w, const char *key = nullptr);
+void json_object_end(JsonWriter &w);
+void json_array_begin(JsonWriter &w, const char *key = nullptr);
+void json_array_end(JsonWriter &w);
+void json_string(JsonWriter &w, const char *key, const char *value);
+void json_int(JsonWriter &w, const char *key, int32_t value);
+void json_uint(JsonWriter &w, const char *key, uint32_t value);
+void json_bool(JsonWriter &w, const char *key, bool value);
+
+enum JsonType : uint8_t {
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_BOOL,
+    JSON_NULL,
+    JSON_OTHER,                 // nested object or array, skipped
+};
+
+struct JsonValue {
+    JsonType type;
+    bool truncated;             // string longer than the buffer given
+    bool integer;               // number without fraction or exponent, fits num
+    bool b;
+    int32_t num;
+    size_t len;                 // unescaped string length stored
+};
+
+struct JsonReader {
+    const char *p;
+    const char *end;
+    uint8_t state;
+    bool error;
+};
+
+void json_reader_init(JsonReader &r, const char *data, size_t len);
+
+// Next member of the object: the key into key[key_size], a string value
+// unescaped into str[str_size]. Returns false at the end of the object or on
+// malformed input (r.error); a key that doesn't fit is an error too.
+bool json_next_member(JsonReader &r, char *key, size_t key_size, JsonValue &v, char *str, size_t str_size);
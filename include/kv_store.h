@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Typed key/value store on top of the wear-leveled flash log.
+//
+// A write appends one record holding only the keys that changed. The first
+// record in each sector is a snapshot of every live key, so recycling the
+// oldest sector never loses data. Values stay in flash; a small sorted RAM
+// index maps each key to its newest copy.
+//
+// Keys 0x0001-0x00FF are reserved for the library (see creds_store.cpp),
+// applications can use 0x0100 and up for their own per-device settings.
+
+#ifndef KV_MAX_KEYS
+#define KV_MAX_KEYS 48
+#endif
+
+#define KV_MAX_VALUE_LEN 255
+#define KV_USER_KEY_BASE 0x0100
+
+enum KvType : uint8_t {
+    KV_TYPE_DELETED = 0,    // tombstone, only seen in the log
+    KV_TYPE_U8      = 1,
+    KV_TYPE_U16     = 2,
+    KV_TYPE_U32     = 3,
+    KV_TYPE_STR     = 4,    // stored without the NUL
+    KV_TYPE_BLOB    = 5,
+};
+
+struct KvWrite {
+    uint16_t key;
+    KvType type;            // KV_TYPE_DELETED removes the key
+    uint8_t len;
+    const void *value;
+};
+
+// Apply several changes as one record; the last entry for a key wins, entries
+// equal to the stored value are skipped, and nothing is written if none changed.
+bool kv_set_many(const KvWrite *w, size_t n);
+
+bool kv_set(uint16_t key, KvType type, const void *value, size_t len);
+bool kv_delete(uint16_t key);
+
+// Copy a value out; returns false if the key is missing or cap is too small
+bool kv_get(uint16_t key, void *buf, size_t cap, size_t *len_out = nullptr, KvType *type_out = nullptr);
+bool kv_exists(uint16_t key);
+
+bool kv_set_u32(uint16_t key, uint32_t v);
+bool kv_get_u32(uint16_t key, uint32_t &out);           // accepts U8/U16/U32
+bool kv_set_str(uint16_t key, const char *s);
+bool kv_get_str(uint16_t key, char *buf, size_t cap);   // NUL-terminated
+
+// Visit live keys in ascending order; value points into flash. Return false to stop.
+typedef bool (*kv_iter_cb)(uint16_t key, KvType type, const void *value, size_t len, void *arg);
+void kv_iter(kv_iter_cb cb, void *arg);
+size_t kv_count();
+
+// Whole-struct image left by older firmware (pre-KV log record, or the original
+// single Blob whose CRC covers image_len bytes), only reported while no
+// key/value snapshot exists yet.
+bool kv_legacy_image(size_t image_len, const void **data, size_t *len);
+
+// Erase the whole region
+void kv_format();
+
+// Drop the RAM index so the next call rescans flash (simulated reboot in bench/)
+void kv_unmount();
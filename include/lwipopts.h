@@ -23,9 +23,12 @@
 // #define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_TCP_SEG            (TCP_SND_QUEUELEN + 8)
 
+// 4 HTTP connections + 2 being shed with a 503 + MQTT + one in TIME_WAIT
+#define MEMP_NUM_TCP_PCB            8
 #define MEMP_NUM_ARP_QUEUE          10
 // #define MEMP_NUM_SYS_TIMEOUT        16
-#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL+1)
+// +1 MQTT keep-alive, +1 DHCP server lease reaper
+#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL+2)
 // #define PBUF_POOL_SIZE              24
 #define PBUF_POOL_SIZE              32
 #define LWIP_ARP                    1
@@ -46,10 +49,20 @@
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                0
+// pool usage is reported on the STA portal's /events stream
+#define LWIP_STATS                  1
 #define MEM_STATS                   0
 #define SYS_STATS                   0
-#define MEMP_STATS                  0
+#define MEMP_STATS                  1
 #define LINK_STATS                  0
+#ifdef NDEBUG
+// release builds keep only the pool counters
+#define ETHARP_STATS                0
+#define IP_STATS                    0
+#define ICMP_STATS                  0
+#define UDP_STATS                   0
+#define TCP_STATS                   0
+#endif
 // #define ETH_PAD_SIZE                2
 #define LWIP_CHKSUM_ALGORITHM       3
 #define LWIP_DHCP                   1
@@ -64,7 +77,6 @@
 
 #ifndef NDEBUG
 #define LWIP_DEBUG                  1
-#define LWIP_STATS                  1
 #define LWIP_STATS_DISPLAY          1
 #endif
 
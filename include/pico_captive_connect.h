@@ -1,19 +1,77 @@
 #pragma once
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include "scheduler.h"
 
-// Initialize networking (STA mode if creds exist, otherwise AP portal)
+// Initialize networking (STA mode if creds exist, otherwise AP portal).
+// Returns at once; the STA connection comes up from net_task().
 void net_init();
 
-// Background service (must be called often in main loop)
+// Background service (call in the main loop). Runs due timers (scheduler.h),
+// then sleeps until the next deadline or network event, at most
+// NET_TASK_MAX_SLEEP_MS, so the loop needs no sleep of its own.
 void net_task();
 
+// Tear down the network and reboot from net_task() after delay_ms; the
+// network keeps running meanwhile. Safe from lwIP callbacks.
+void net_schedule_reboot(uint32_t delay_ms);
+
 // Query state
 bool net_is_connected();   // true if Wi-Fi STA connected + IP
 bool mqtt_is_connected();  // true if MQTT session is alive
 
+// STA connection progress. Each of JOINING and DHCP has its own timeout
+// (NET_STA_JOIN_TIMEOUT_MS, NET_STA_DHCP_TIMEOUT_MS); FAILED means the AP
+// portal took over.
+enum NetStaState : uint8_t {
+    NET_STA_IDLE,
+    NET_STA_JOINING,            // association and WPA handshake
+    NET_STA_DHCP,               // linked, waiting for a lease
+    NET_STA_UP,
+    NET_STA_FAILED,
+};
+
+NetStaState net_sta_state();
+
+// The last good BSSID, channel and DHCP lease are kept with the creds; the
+// next connect joins that AP directly (NET_STA_FAST_JOIN_TIMEOUT_MS before a
+// full scan) and asks for the same address.
+struct NetStaStats {
+    uint32_t connects;
+    uint32_t fast_joins;        // joined the remembered AP without a scan
+    uint32_t fast_join_misses;  // remembered AP not found, scanned instead
+    uint32_t leases_reused;     // DHCP confirmed the remembered address
+    uint32_t last_join_ms;      // start to associated
+    uint32_t last_dhcp_ms;      // associated to an IP
+    uint32_t boot_to_ip_ms;     // since boot, first connect only
+};
+const NetStaStats &net_sta_stats();
+// t is deferred with fn(arg) on every STA state change (nullptr to stop)
+void net_sta_watch(SchedTimer *t, sched_fn fn, void *arg);
+
 //mqtt api
 bool mqtt_connect();
 void mqtt_try_connect();
 bool publish_mqtt(const char* topic, const char* payload, size_t len);
 const char* net_hostname();
+
+// MQTT session state as a word: "disconnected", "connecting", "connected"
+const char *mqtt_state_name();
+
+// Counters for the STA portal's /events stream
+struct NetTelemetry {
+    int32_t rssi;               // dBm at the last sample, 0 if not associated
+    uint32_t mqtt_connects;
+    uint32_t mqtt_drops;        // sessions lost after being accepted
+    uint32_t pub_ok;            // publishes the broker confirmed
+    uint32_t pub_failed;
+    uint32_t pub_err_mem;       // lwIP send queue full
+    uint32_t pub_busy;          // refused, previous publish still in flight
+};
+
+const NetTelemetry &net_telemetry();
+// Refresh the RSSI (a driver call: from net_task() only, not lwIP callbacks)
+void net_telemetry_sample();
+// t is deferred with fn(arg) on every MQTT state change (nullptr to stop)
+void net_telemetry_watch(SchedTimer *t, sched_fn fn, void *arg);
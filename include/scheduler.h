@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+
+// Timers and deferred work run from net_task(), outside lwIP callbacks.
+// Timers hash into a small wheel by deadline, so arming, cancelling and
+// expiry are O(1) per timer; net_task() sleeps until the next deadline.
+
+#ifndef SCHED_WHEEL_SLOTS
+// power of two; deadlines further out than a turn just stay in their slot
+#define SCHED_WHEEL_SLOTS 32
+#endif
+
+#ifndef SCHED_TICK_MS
+// wheel granularity (power of two); expiry itself is exact to the ms
+#define SCHED_TICK_MS 16
+#endif
+
+typedef void (*sched_fn)(void *arg);
+
+// Owned by the caller (usually a static); zero-initialised means idle
+struct SchedTimer {
+    SchedTimer *next;
+    SchedTimer **pprev;         // nullptr while not armed
+    uint32_t due_ms;
+    uint32_t period_ms;         // 0 = one-shot
+    sched_fn fn;
+    void *arg;
+};
+
+// Run fn after delay_ms, then every period_ms if nonzero. Re-arming a running
+// timer moves it. Safe from lwIP callbacks; fn always runs from net_task().
+void sched_timer_start(SchedTimer &t, uint32_t delay_ms, uint32_t period_ms, sched_fn fn, void *arg);
+
+// Run fn on the next net_task() pass
+void sched_defer(SchedTimer &t, sched_fn fn, void *arg);
+
+void sched_timer_stop(SchedTimer &t);
+bool sched_timer_armed(const SchedTimer &t);
+
+// Run every timer that is due; returns ms until the next deadline
+// (UINT32_MAX if nothing is armed)
+uint32_t sched_run();
+
+// Called whenever a timer is armed, so a sleeping loop re-evaluates its
+// deadline (net_init() installs one that wakes the cyw43 async context)
+void sched_set_wake(void (*wake)(void));
+void sched_wake();
+
+struct SchedStats {
+    uint32_t fired;
+    uint32_t max_late_ms;       // worst delay between deadline and callback
+};
+
+const SchedStats &sched_stats();
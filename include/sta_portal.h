@@ -3,4 +3,8 @@
 
 // Start the STA-mode web server
 void sta_http_start(void);
+void sta_http_stop(void);
+
+// Connection and per-route counters, printed
+void sta_http_print_stats(void);
 
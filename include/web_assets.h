@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+
+// Files from web/, gzip'd at build time by cmake/embed_assets.cmake and kept
+// in flash. Each comes with its response header (status line through
+// Cache-Control) so serving one is a couple of tcp_write()s with no copying.
+
+struct WebAsset {
+    const char *path;           // URL path, "/" + file name
+    const uint8_t *data;        // gzip'd body
+    uint32_t len;
+    const char *header;         // without Connection and the blank line
+    uint16_t header_len;
+    const char *etag;           // quoted, as sent
+};
+
+extern const WebAsset web_assets[];
+extern const unsigned web_asset_count;
+
+const WebAsset *web_asset_find(const char *path);
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+
+// Background Wi-Fi scan for the AP portal's network picker. Scans are started
+// from net_task() and run in the driver; results land in a fixed table,
+// one entry per SSID (strongest BSS kept), sorted by RSSI.
+
+#ifndef WIFI_SCAN_MAX
+#define WIFI_SCAN_MAX 16
+#endif
+
+#ifndef WIFI_SCAN_INTERVAL_MS
+// the radio leaves the AP channel while scanning, so not too often
+#define WIFI_SCAN_INTERVAL_MS 30000
+#endif
+
+struct WifiNetwork {
+    char ssid[33];
+    uint8_t bssid[6];
+    int16_t rssi;               // dBm
+    uint8_t channel;
+    uint8_t auth;               // cyw43 scan auth bits, see wifi_auth_name()
+};
+
+struct WifiScanTable {
+    WifiNetwork nets[WIFI_SCAN_MAX];
+    uint8_t count;
+    uint32_t generation;        // bumped per completed scan, 0 = none yet
+    uint32_t updated_ms;        // to_ms_since_boot() of the last completed scan
+};
+
+// First scan at once, then every WIFI_SCAN_INTERVAL_MS
+void wifi_scan_start();
+void wifi_scan_stop();
+
+// Scan again now rather than at the next interval (from any context)
+void wifi_scan_request();
+bool wifi_scan_busy();
+
+// Last completed scan. Read it from lwIP callbacks (or with lwIP locked): it
+// is replaced under that lock.
+const WifiScanTable &wifi_scan_results();
+
+// "open", "wep", "wpa", "wpa2" or "wpa/wpa2"
+const char *wifi_auth_name(uint8_t auth);
@@ -0,0 +1,138 @@
+#include "crc32.h"
+
+#if CRC32_BACKEND == CRC32_BACKEND_DMA
+#include "hardware/dma.h"
+#endif
+
+#define CRC32_POLY 0xEDB88320u
+
+template <int N>
+struct Crc32Tables {
+    uint32_t t[N][256];
+};
+
+// t[0] is the classic byte table; t[k][b] is the CRC of b followed by k zero bytes
+template <int N>
+static constexpr Crc32Tables<N> make_tables() {
+    Crc32Tables<N> r{};
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t c = b;
+        for (int i = 0; i < 8; i++)
+            c = (c & 1) ? (CRC32_POLY ^ (c >> 1)) : (c >> 1);
+        r.t[0][b] = c;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < N; k++)
+            r.t[k][b] = (r.t[k - 1][b] >> 8) ^ r.t[0][r.t[k - 1][b] & 0xFF];
+    }
+    return r;
+}
+
+// separate objects so unused slice tables are dropped by --gc-sections
+static constexpr Crc32Tables<1> byte_table = make_tables<1>();
+static constexpr Crc32Tables<8> slice_tables = make_tables<8>();
+
+static_assert(byte_table.t[0][1] == 0x77073096u, "crc32 table generation");
+static_assert(byte_table.t[0][255] == 0x2D02EF8Du, "crc32 table generation");
+
+uint32_t crc32_update_bitwise(uint32_t crc, const void *data, size_t len) {
+    uint32_t c = ~crc;
+    const uint8_t *p = (const uint8_t*)data;
+    while (len--) {
+        c ^= *p++;
+        for (int i=0;i<8;i++)
+            c = (c & 1) ? (CRC32_POLY ^ (c >> 1)) : (c >> 1);
+    }
+    return ~c;
+}
+
+uint32_t crc32_update_table(uint32_t crc, const void *data, size_t len) {
+    uint32_t c = ~crc;
+    const uint8_t *p = (const uint8_t*)data;
+    while (len--) {
+        c = byte_table.t[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+// Little-endian slice-by-8 (both RP2040/RP2350 and the usual hosts are LE)
+uint32_t crc32_update_slice8(uint32_t crc, const void *data, size_t len) {
+    uint32_t c = ~crc;
+    const uint8_t *p = (const uint8_t*)data;
+
+    // byte-wise until word aligned; Cortex-M0+ can't do unaligned loads
+    while (len && ((uintptr_t)p & 3)) {
+        c = slice_tables.t[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo = ((const uint32_t*)p)[0] ^ c;
+        uint32_t hi = ((const uint32_t*)p)[1];
+        c = slice_tables.t[7][lo & 0xFF] ^ slice_tables.t[6][(lo >> 8) & 0xFF] ^
+            slice_tables.t[5][(lo >> 16) & 0xFF] ^ slice_tables.t[4][lo >> 24] ^
+            slice_tables.t[3][hi & 0xFF] ^ slice_tables.t[2][(hi >> 8) & 0xFF] ^
+            slice_tables.t[1][(hi >> 16) & 0xFF] ^ slice_tables.t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        c = slice_tables.t[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+#if CRC32_BACKEND == CRC32_BACKEND_DMA
+
+static uint32_t bit_reverse(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+    v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+// The sniffer runs the MSB-first CRC-32 over bit-reversed bytes (CRC32R), which
+// is the reflected zlib CRC with the register bit-reversed. Seed it with the
+// reversed running state and let the read-back reverse/invert finish it.
+uint32_t crc32_update_dma(uint32_t crc, const void *data, size_t len) {
+    if (len < CRC32_DMA_MIN_LEN) return crc32_update_table(crc, data, len);
+
+    int ch = dma_claim_unused_channel(false);
+    if (ch < 0) return crc32_update_table(crc, data, len);
+
+    static uint8_t sink;
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_sniff_enable(&cfg, true);
+
+    dma_sniffer_set_data_accumulator(bit_reverse(~crc));
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_enable(ch, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+
+    dma_channel_configure(ch, &cfg, &sink, data, len, true);
+    dma_channel_wait_for_finish_blocking(ch);
+
+    uint32_t result = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    dma_sniffer_set_output_reverse_enabled(false);
+    dma_sniffer_set_output_invert_enabled(false);
+    dma_channel_unclaim(ch);
+    return result;
+}
+
+#endif
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+#if CRC32_BACKEND == CRC32_BACKEND_BITWISE
+    return crc32_update_bitwise(crc, data, len);
+#elif CRC32_BACKEND == CRC32_BACKEND_SLICE8
+    return crc32_update_slice8(crc, data, len);
+#elif CRC32_BACKEND == CRC32_BACKEND_DMA
+    return crc32_update_dma(crc, data, len);
+#else
+    return crc32_update_table(crc, data, len);
+#endif
+}
@@ -0,0 +1,98 @@
+#include "creds_json.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+enum FieldKind : uint8_t {
+    F_STRING,
+    F_SECRET,       // write-only string
+    F_PORT,
+};
+
+struct CredsField {
+    const char *name;
+    FieldKind kind;
+    uint16_t offset;
+    uint16_t size;
+};
+
+#define CREDS_FIELD(name, kind, member) \
+    {name, kind, offsetof(DeviceCreds, member), sizeof(DeviceCreds::member)}
+
+static const CredsField fields[] = {
+    CREDS_FIELD("ssid",       F_STRING, ssid),
+    CREDS_FIELD("wifi_pass",  F_SECRET, wifi_pass),
+    CREDS_FIELD("hostname",   F_STRING, hostname),
+    CREDS_FIELD("mqtt_host",  F_STRING, mqtt_host),
+    CREDS_FIELD("mqtt_port",  F_PORT,   mqtt_port),
+    CREDS_FIELD("mqtt_user",  F_STRING, mqtt_user),
+    CREDS_FIELD("mqtt_pass",  F_SECRET, mqtt_pass),
+    CREDS_FIELD("mqtt_topic", F_STRING, mqtt_topic),
+};
+
+void creds_json_write(JsonWriter &w, const DeviceCreds &c) {
+    const char *base = (const char*)&c;
+    json_object_begin(w);
+    for (const CredsField &f : fields) {
+        switch (f.kind) {
+        case F_STRING:
+            json_string(w, f.name, base + f.offset);
+            break;
+        case F_SECRET: {
+            char key[24];
+            snprintf(key, sizeof(key), "%s_set", f.name);
+            json_bool(w, key, base[f.offset] != '\0');
+            break;
+        }
+        case F_PORT:
+            json_uint(w, f.name, c.mqtt_port ? c.mqtt_port : 1883);
+            break;
+        }
+    }
+    json_object_end(w);
+}
+
+static int reject(char *err, size_t err_size, const char *key, const char *why) {
+    snprintf(err, err_size, "%s: %s", key, why);
+    return 400;
+}
+
+int creds_json_apply(DeviceCreds &c, const char *json, size_t len, char *err, size_t err_size) {
+    // staged so a bad member leaves the caller's copy alone
+    DeviceCreds out = c;
+    char *base = (char*)&out;
+    JsonReader r;
+    JsonValue v;
+    char key[24];
+    char str[sizeof(DeviceCreds::wifi_pass) + 1];
+    json_reader_init(r, json, len);
+    while (json_next_member(r, key, sizeof(key), v, str, sizeof(str))) {
+        const CredsField *f = nullptr;
+        for (const CredsField &k : fields) {
+            if (!strcmp(k.name, key)) f = &k;
+        }
+        if (!f) return reject(err, err_size, key, "unknown setting");
+        if (f->kind == F_PORT) {
+            if (v.type != JSON_NUMBER || !v.integer || v.num < 1 || v.num > 65535) {
+                return reject(err, err_size, key, "expected a port number");
+            }
+            out.mqtt_port = (uint16_t)v.num;
+            continue;
+        }
+        if (v.type == JSON_NULL) {
+            base[f->offset] = '\0';
+            continue;
+        }
+        if (v.type != JSON_STRING) return reject(err, err_size, key, "expected a string");
+        if (v.truncated || v.len >= f->size) return reject(err, err_size, key, "too long");
+        if (memchr(str, '\0', v.len)) return reject(err, err_size, key, "contains NUL");
+        memcpy(base + f->offset, str, v.len + 1);
+    }
+    if (r.error) {
+        snprintf(err, err_size, "malformed JSON object");
+        return 400;
+    }
+    out.valid = out.ssid[0] != '\0';
+    c = out;
+    return 0;
+}
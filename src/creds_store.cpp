@@ -1,70 +1,398 @@
 #include "creds_store.h"
-#include "pico/stdlib.h"
-#include "hardware/flash.h"
-#include "hardware/sync.h"
+#include "kv_store.h"
+#include "pico/critical_section.h"
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#ifndef CREDS_FLASH_OFFSET
-// reserve last 64KB sector (adjust if you already use it)
-#define CREDS_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - 64*1024)
-#endif
+// DeviceCreds is kept as individual keys in the KV store, so a save only
+// writes the fields that changed and new fields don't invalidate old images.
+enum CredsKey : uint16_t {
+    CREDS_KEY_VALID      = 0x0001,
+    CREDS_KEY_DIRTY      = 0x0002,
+    CREDS_KEY_SSID       = 0x0003,
+    CREDS_KEY_WIFI_PASS  = 0x0004,
+    CREDS_KEY_MQTT_HOST  = 0x0005,
+    CREDS_KEY_MQTT_PORT  = 0x0006,
+    CREDS_KEY_MQTT_USER  = 0x0007,
+    CREDS_KEY_MQTT_PASS  = 0x0008,
+    CREDS_KEY_MQTT_TOPIC = 0x0009,
+    CREDS_KEY_HOSTNAME   = 0x000A,
+    CREDS_KEY_BROKER_ADDR = 0x000B,   // not a DeviceCreds field, see creds_broker_addr()
+    CREDS_KEY_LINK_CACHE  = 0x000C,   // same, see creds_link_cache()
+};
+
+struct CredsField {
+    uint16_t key;
+    KvType type;
+    uint16_t offset;
+    uint16_t size;
+};
 
-#define CREDS_MAGIC 0x43525749u  // 'I','W','R','C' (just a tag)
+#define CREDS_FIELD(k, t, m) { k, t, offsetof(DeviceCreds, m), sizeof(DeviceCreds::m) }
 
-struct Blob {
-    uint32_t magic;
-    uint32_t crc;
-    DeviceCreds creds;
+static const CredsField creds_fields[] = {
+    CREDS_FIELD(CREDS_KEY_VALID,      KV_TYPE_U8,  valid),
+    CREDS_FIELD(CREDS_KEY_DIRTY,      KV_TYPE_U8,  dirty),
+    CREDS_FIELD(CREDS_KEY_SSID,       KV_TYPE_STR, ssid),
+    CREDS_FIELD(CREDS_KEY_WIFI_PASS,  KV_TYPE_STR, wifi_pass),
+    CREDS_FIELD(CREDS_KEY_MQTT_HOST,  KV_TYPE_STR, mqtt_host),
+    CREDS_FIELD(CREDS_KEY_MQTT_PORT,  KV_TYPE_U16, mqtt_port),
+    CREDS_FIELD(CREDS_KEY_MQTT_USER,  KV_TYPE_STR, mqtt_user),
+    CREDS_FIELD(CREDS_KEY_MQTT_PASS,  KV_TYPE_STR, mqtt_pass),
+    CREDS_FIELD(CREDS_KEY_MQTT_TOPIC, KV_TYPE_STR, mqtt_topic),
+    CREDS_FIELD(CREDS_KEY_HOSTNAME,   KV_TYPE_STR, hostname),
 };
 
-static uint32_t crc32(const void *data, size_t len){
-    uint32_t c = 0xFFFFFFFFu;
-    const uint8_t *p = (const uint8_t*)data;
-    while (len--) {
-        c ^= *p++;
-        for (int i=0;i<8;i++)
-            c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+#define CREDS_FIELD_COUNT (sizeof(creds_fields) / sizeof(creds_fields[0]))
+
+static bool kv_to_creds(DeviceCreds &out) {
+    if (!kv_exists(CREDS_KEY_VALID)) return false;
+    for (const CredsField &f : creds_fields) {
+        uint8_t *dst = (uint8_t*)&out + f.offset;
+        size_t len = 0;
+        memset(dst, 0, f.size);
+        // strings keep their NUL, so read at most size-1 bytes
+        kv_get(f.key, dst, f.type == KV_TYPE_STR ? f.size - 1 : f.size, &len);
     }
-    return ~c;
+    return true;
 }
 
-bool creds_load(DeviceCreds &out) {
-    const Blob *b = (const Blob*)(XIP_BASE + CREDS_FLASH_OFFSET);
-    if (b->magic != CREDS_MAGIC) return false;
-    uint32_t calc = crc32(&b->creds, sizeof(DeviceCreds));
-    if (calc != b->crc) return false;
-    out = b->creds;
+static bool creds_to_kv(const DeviceCreds &in) {
+    KvWrite w[CREDS_FIELD_COUNT];
+    for (size_t i = 0; i < CREDS_FIELD_COUNT; i++) {
+        const CredsField &f = creds_fields[i];
+        const uint8_t *src = (const uint8_t*)&in + f.offset;
+        size_t len = f.type == KV_TYPE_STR ? strnlen((const char*)src, f.size - 1) : f.size;
+        w[i] = KvWrite{f.key, f.type, (uint8_t)len, src};
+    }
+    return kv_set_many(w, CREDS_FIELD_COUNT);
+}
+
+// Flash is read once; afterwards every load is served from this mirror
+static DeviceCreds cache;
+static bool cache_loaded;
+static bool cache_present;  // flash held an image
+static uint32_t generation;
+
+struct Subscriber {
+    creds_change_cb cb;
+    void *arg;
+};
+static Subscriber subscribers[CREDS_MAX_SUBSCRIBERS];
 
-    if (out.dirty) {
+// Queued async write: newer requests replace the image, waiters accumulate
+struct Waiter {
+    creds_save_cb cb;
+    void *arg;
+};
+static critical_section_t queue_lock;
+static bool queue_lock_ready;
+static bool pending_valid;
+static DeviceCreds pending;
+static Waiter waiters[CREDS_ASYNC_MAX_WAITERS];
+static int waiter_count;
+
+// Last good broker address, queued from lwIP callbacks like the creds image
+struct BrokerAddr {
+    bool valid;
+    uint32_t addr;
+    char host[sizeof(DeviceCreds::mqtt_host)];
+};
+static BrokerAddr broker_pending;
+
+struct LinkPending {
+    bool valid;
+    WifiLinkCache link;
+    char ssid[sizeof(DeviceCreds::ssid)];
+};
+static LinkPending link_pending;
+
+static CredsStats stats;
+
+static bool read_flash(DeviceCreds &out) {
+    if (kv_to_creds(out)) return true;
+
+    // image from older firmware; the first save converts it to keys
+    const void *img;
+    size_t len;
+    if (!kv_legacy_image(sizeof(DeviceCreds), &img, &len)) return false;
+    memcpy(&out, img, len < sizeof(DeviceCreds) ? len : sizeof(DeviceCreds));
+    return true;
+}
+
+static void cache_fill() {
+    if (cache_loaded) return;
+    cache_loaded = true;
+    memset(&cache, 0, sizeof(cache));
+    cache_present = read_flash(cache);
+
+    if (cache_present && cache.dirty) {
         // clear dirty immediately so we don't reboot repeatedly
-        DeviceCreds cleared = out;
-        cleared.dirty = false;
-        creds_save(cleared);
+        cache.dirty = false;
+        creds_to_kv(cache);
+    }
+}
+
+static void notify() {
+    generation++;
+    for (const Subscriber &s : subscribers) {
+        if (s.cb) s.cb(cache, generation, s.arg);
     }
+}
 
+static void queue_lock_init() {
+    // first call comes from net_init() before any lwIP callback can queue
+    if (!queue_lock_ready) {
+        critical_section_init(&queue_lock);
+        queue_lock_ready = true;
+    }
+}
+
+bool creds_load(DeviceCreds &out) {
+    cache_fill();
+    if (!cache_present) return false;
+    out = cache;
     return out.valid;
 }
 
+DeviceCreds creds_get() {
+    queue_lock_init();
+    cache_fill();
+    // a queued write is the newest accepted state
+    critical_section_enter_blocking(&queue_lock);
+    DeviceCreds c = pending_valid ? pending : cache;
+    critical_section_exit(&queue_lock);
+    return c;
+}
+
+uint32_t creds_generation() {
+    return generation;
+}
+
+bool creds_subscribe(creds_change_cb cb, void *arg) {
+    for (Subscriber &s : subscribers) {
+        if (!s.cb) {
+            s.cb = cb;
+            s.arg = arg;
+            return true;
+        }
+    }
+    return false;
+}
+
+void creds_unsubscribe(creds_change_cb cb, void *arg) {
+    for (Subscriber &s : subscribers) {
+        if (s.cb == cb && s.arg == arg) s.cb = nullptr;
+    }
+}
+
 bool creds_save(const DeviceCreds &in, bool mark_dirty) {
-    Blob b{};
-    b.magic = CREDS_MAGIC;
-    b.creds = in;
-    b.creds.valid = true;
+    DeviceCreds c = in;
+    c.valid = true;
     if (mark_dirty) {
-        b.creds.dirty = true;
+        c.dirty = true;
     }
-    b.crc = crc32(&b.creds, sizeof(DeviceCreds));
+    if (!creds_to_kv(c)) {
+        stats.failed++;
+        return false;
+    }
+    stats.committed++;
 
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(CREDS_FLASH_OFFSET, FLASH_SECTOR_SIZE);
-    flash_range_program(CREDS_FLASH_OFFSET, (const uint8_t*)&b, sizeof(b));
-    restore_interrupts(ints);
+    // creds_get() copies it from lwIP callbacks
+    queue_lock_init();
+    critical_section_enter_blocking(&queue_lock);
+    cache_loaded = true;
+    cache_present = true;
+    cache = c;
+    critical_section_exit(&queue_lock);
+    notify();
     return true;
 }
 
 void creds_clear() {
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(CREDS_FLASH_OFFSET, FLASH_SECTOR_SIZE);
-    restore_interrupts(ints);
-}
\ No newline at end of file
+    // only the credential keys (kv_format() wipes everything); keeping an
+    // explicit valid=0 also retires any legacy image
+    static const uint8_t zero = 0;
+    KvWrite w[CREDS_FIELD_COUNT + 2];
+    for (size_t i = 0; i < CREDS_FIELD_COUNT; i++) {
+        w[i] = KvWrite{creds_fields[i].key, KV_TYPE_DELETED, 0, nullptr};
+        if (creds_fields[i].key == CREDS_KEY_VALID) w[i] = KvWrite{CREDS_KEY_VALID, KV_TYPE_U8, 1, &zero};
+    }
+    w[CREDS_FIELD_COUNT] = KvWrite{CREDS_KEY_BROKER_ADDR, KV_TYPE_DELETED, 0, nullptr};
+    w[CREDS_FIELD_COUNT + 1] = KvWrite{CREDS_KEY_LINK_CACHE, KV_TYPE_DELETED, 0, nullptr};
+    kv_set_many(w, CREDS_FIELD_COUNT + 2);
+
+    queue_lock_init();
+    critical_section_enter_blocking(&queue_lock);
+    cache_loaded = true;
+    cache_present = false;
+    memset(&cache, 0, sizeof(cache));
+    critical_section_exit(&queue_lock);
+    notify();
+}
+
+bool creds_save_async(const DeviceCreds &in, bool mark_dirty, creds_save_cb cb, void *arg) {
+    queue_lock_init();
+    cache_fill();
+
+    critical_section_enter_blocking(&queue_lock);
+    if (cb && waiter_count == CREDS_ASYNC_MAX_WAITERS) {
+        critical_section_exit(&queue_lock);
+        return false;
+    }
+    // a dirty request stays dirty even if a plain save replaces it
+    bool was_dirty = pending_valid && pending.dirty;
+    if (pending_valid) stats.coalesced++;
+    pending = in;
+    pending.valid = true;
+    pending.dirty = mark_dirty || in.dirty || was_dirty;
+    pending_valid = true;
+    if (cb) waiters[waiter_count++] = Waiter{cb, arg};
+    stats.queued++;
+    critical_section_exit(&queue_lock);
+    return true;
+}
+
+// Stored as the IPv4 address followed by the host name it was resolved for
+static void broker_addr_commit() {
+    BrokerAddr b;
+    critical_section_enter_blocking(&queue_lock);
+    b = broker_pending;
+    broker_pending.valid = false;
+    critical_section_exit(&queue_lock);
+
+    uint8_t buf[4 + sizeof(b.host)];
+    size_t n = strnlen(b.host, sizeof(b.host) - 1);
+    memcpy(buf, &b.addr, 4);
+    memcpy(buf + 4, b.host, n);
+    // unchanged values are skipped by the store, so this rarely writes
+    if (!kv_set(CREDS_KEY_BROKER_ADDR, KV_TYPE_BLOB, buf, 4 + n)) stats.failed++;
+}
+
+bool creds_broker_addr(const char *host, uint32_t &addr) {
+    // the setter runs from lwIP callbacks
+    BrokerAddr b;
+    queue_lock_init();
+    critical_section_enter_blocking(&queue_lock);
+    b = broker_pending;
+    critical_section_exit(&queue_lock);
+    if (b.valid && strcmp(b.host, host) == 0) {
+        addr = b.addr;
+        return true;
+    }
+    uint8_t buf[4 + sizeof(DeviceCreds::mqtt_host)];
+    size_t len = 0;
+    if (!kv_get(CREDS_KEY_BROKER_ADDR, buf, sizeof(buf), &len) || len < 4) return false;
+    size_t n = strlen(host);
+    if (len - 4 != n || memcmp(buf + 4, host, n) != 0) return false;
+    memcpy(&addr, buf, 4);
+    return true;
+}
+
+void creds_set_broker_addr(const char *host, uint32_t addr) {
+    queue_lock_init();
+    critical_section_enter_blocking(&queue_lock);
+    broker_pending.addr = addr;
+    strncpy(broker_pending.host, host, sizeof(broker_pending.host) - 1);
+    broker_pending.host[sizeof(broker_pending.host) - 1] = '\0';
+    broker_pending.valid = true;
+    critical_section_exit(&queue_lock);
+}
+
+// Packed field by field (no padding, so an unchanged link compares equal in
+// the store), followed by the SSID
+#define LINK_CACHE_LEN 31
+
+static size_t link_cache_pack(uint8_t *buf, const WifiLinkCache &c) {
+    const uint32_t words[] = {c.auth, c.ip, c.netmask, c.gw, c.dns, c.lease_left_s};
+    memcpy(buf, c.bssid, 6);
+    buf[6] = c.channel;
+    memcpy(buf + 7, words, sizeof(words));
+    return LINK_CACHE_LEN;
+}
+
+static void link_cache_unpack(WifiLinkCache &c, const uint8_t *buf) {
+    uint32_t words[6];
+    memcpy(c.bssid, buf, 6);
+    c.channel = buf[6];
+    memcpy(words, buf + 7, sizeof(words));
+    c.auth = words[0];
+    c.ip = words[1];
+    c.netmask = words[2];
+    c.gw = words[3];
+    c.dns = words[4];
+    c.lease_left_s = words[5];
+}
+
+static void link_cache_commit() {
+    LinkPending l;
+    critical_section_enter_blocking(&queue_lock);
+    l = link_pending;
+    link_pending.valid = false;
+    critical_section_exit(&queue_lock);
+
+    uint8_t buf[LINK_CACHE_LEN + sizeof(l.ssid)];
+    size_t n = strnlen(l.ssid, sizeof(l.ssid) - 1);
+    link_cache_pack(buf, l.link);
+    memcpy(buf + LINK_CACHE_LEN, l.ssid, n);
+    if (!kv_set(CREDS_KEY_LINK_CACHE, KV_TYPE_BLOB, buf, LINK_CACHE_LEN + n)) stats.failed++;
+}
+
+bool creds_link_cache(const char *ssid, WifiLinkCache &out) {
+    // creds_service() may commit and clear it meanwhile
+    LinkPending l;
+    queue_lock_init();
+    critical_section_enter_blocking(&queue_lock);
+    l = link_pending;
+    critical_section_exit(&queue_lock);
+    if (l.valid && strcmp(l.ssid, ssid) == 0) {
+        out = l.link;
+        return true;
+    }
+    uint8_t buf[LINK_CACHE_LEN + sizeof(DeviceCreds::ssid)];
+    size_t len = 0;
+    if (!kv_get(CREDS_KEY_LINK_CACHE, buf, sizeof(buf), &len) || len < LINK_CACHE_LEN) return false;
+    size_t n = strlen(ssid);
+    if (len - LINK_CACHE_LEN != n || memcmp(buf + LINK_CACHE_LEN, ssid, n) != 0) return false;
+    link_cache_unpack(out, buf);
+    return true;
+}
+
+void creds_set_link_cache(const char *ssid, const WifiLinkCache &c) {
+    queue_lock_init();
+    critical_section_enter_blocking(&queue_lock);
+    link_pending.link = c;
+    strncpy(link_pending.ssid, ssid, sizeof(link_pending.ssid) - 1);
+    link_pending.ssid[sizeof(link_pending.ssid) - 1] = '\0';
+    link_pending.valid = true;
+    critical_section_exit(&queue_lock);
+}
+
+void creds_service() {
+    queue_lock_init();
+    if (broker_pending.valid) broker_addr_commit();
+    if (link_pending.valid) link_cache_commit();
+    if (!pending_valid) return;
+
+    static DeviceCreds img;
+    Waiter done[CREDS_ASYNC_MAX_WAITERS];
+    critical_section_enter_blocking(&queue_lock);
+    img = pending;
+    pending_valid = false;
+    int n = waiter_count;
+    memcpy(done, waiters, sizeof(Waiter) * n);
+    waiter_count = 0;
+    critical_section_exit(&queue_lock);
+
+    bool ok = creds_save(img, img.dirty);
+    for (int i = 0; i < n; i++) done[i].cb(ok, done[i].arg);
+}
+
+bool creds_save_pending() {
+    return pending_valid;
+}
+
+CredsStats creds_stats() {
+    return stats;
+}
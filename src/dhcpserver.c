@@ -31,10 +31,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #include "cyw43_config.h"
 #include "dhcpserver.h"
 #include "lwip/udp.h"
+#include "lwip/timeouts.h"
 
 #define DHCPDISCOVER    (1)
 #define DHCPOFFER       (2)
@@ -58,14 +61,43 @@
 #define DHCP_OPT_MAX_MSG_SIZE       (57)
 #define DHCP_OPT_VENDOR_CLASS_ID    (60)
 #define DHCP_OPT_CLIENT_ID          (61)
+#define DHCP_OPT_RAPID_COMMIT       (80)
+#define DHCP_OPT_CAPTIVE_URI        (114)
 #define DHCP_OPT_END                (255)
 
 #define PORT_DHCP_SERVER (67)
 #define PORT_DHCP_CLIENT (68)
 
-#define DEFAULT_LEASE_TIME_S (24 * 60 * 60) // in seconds
+#ifndef DHCPS_LEASE_TIME_S
+#define DHCPS_LEASE_TIME_S (24 * 60 * 60)
+#endif
+#define DEFAULT_LEASE_TIME_S DHCPS_LEASE_TIME_S // in seconds
+
+#ifndef DHCPS_OFFER_HOLD_S
+// how long an offered address stays reserved without a REQUEST
+#define DHCPS_OFFER_HOLD_S (60)
+#endif
+
+#ifndef DHCPS_DECLINE_HOLD_S
+// a declined address is in use by someone else; keep it out of the pool
+#define DHCPS_DECLINE_HOLD_S (10 * 60)
+#endif
+
+#define DHCPS_REAP_INTERVAL_MS (10 * 1000)
+
+#ifndef DHCPS_RAPID_COMMIT
+// answer DISCOVER + Rapid Commit (RFC 4039) with an ACK straight away
+#define DHCPS_RAPID_COMMIT (1)
+#endif
+
+#define DHCPS_LEASE_FREE     (0)
+#define DHCPS_LEASE_OFFERED  (1)
+#define DHCPS_LEASE_BOUND    (2)
+#define DHCPS_LEASE_DECLINED (3)
 
 #define MAC_LEN (6)
+#define BOOTREPLY (2)
+#define BOOTP_MIN_LEN (300) // some clients drop shorter replies
 #define MAKE_IP4(a, b, c, d) ((a) << 24 | (b) << 16 | (c) << 8 | (d))
 
 typedef struct {
@@ -86,6 +118,10 @@ typedef struct {
     uint8_t options[312]; // optional parameters, variable, starts with magic
 } dhcp_msg_t;
 
+#define MSG_OFS(f) offsetof(dhcp_msg_t, f)
+#define DHCP_OPTIONS_OFS (MSG_OFS(options) + 4) // past the magic cookie
+#define DHCP_MIN_SIZE (DHCP_OPTIONS_OFS + 3)
+
 static int dhcp_socket_new_dgram(struct udp_pcb **udp, void *cb_data, udp_recv_fn cb_udp_recv) {
     // family is AF_INET
     // type is SOCK_DGRAM
@@ -113,17 +149,8 @@ static int dhcp_socket_bind(struct udp_pcb **udp, uint16_t port) {
     return udp_bind(*udp, IP_ANY_TYPE, port);
 }
 
-static int dhcp_socket_sendto(struct udp_pcb **udp, struct netif *nif, const void *buf, size_t len, uint32_t ip, uint16_t port) {
-    if (len > 0xffff) {
-        len = 0xffff;
-    }
-
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-    if (p == NULL) {
-        return -ENOMEM;
-    }
-
-    memcpy(p->payload, buf, len);
+static int dhcp_socket_sendto(struct udp_pcb **udp, struct netif *nif, struct pbuf *p, size_t len, uint32_t ip, uint16_t port) {
+    p->len = p->tot_len = len;
 
     ip_addr_t dest;
     IP4_ADDR(ip_2_ip4(&dest), ip >> 24 & 0xff, ip >> 16 & 0xff, ip >> 8 & 0xff, ip & 0xff);
@@ -134,8 +161,6 @@ static int dhcp_socket_sendto(struct udp_pcb **udp, struct netif *nif, const voi
         err = udp_sendto(*udp, p, &dest, port);
     }
 
-    pbuf_free(p);
-
     if (err != ERR_OK) {
         return err;
     }
@@ -143,14 +168,27 @@ static int dhcp_socket_sendto(struct udp_pcb **udp, struct netif *nif, const voi
     return len;
 }
 
-static uint8_t *opt_find(uint8_t *opt, uint8_t cmd) {
-    for (int i = 0; i < 308 && opt[i] != DHCP_OPT_END;) {
-        if (opt[i] == cmd) {
-            return &opt[i];
+// Offset of option cmd in the request, or -1. Works on chained pbufs.
+static int opt_find(const struct pbuf *p, uint8_t cmd) {
+    for (int i = DHCP_OPTIONS_OFS; i < p->tot_len;) {
+        int o = pbuf_try_get_at(p, i);
+        if (o < 0 || o == DHCP_OPT_END) {
+            break;
+        }
+        if (o == DHCP_OPT_PAD) {
+            ++i;
+            continue;
+        }
+        int n = pbuf_try_get_at(p, i + 1);
+        if (n < 0 || i + 2 + n > p->tot_len) {
+            break;
+        }
+        if (o == cmd) {
+            return i;
         }
-        i += 2 + opt[i + 1];
+        i += 2 + n;
     }
-    return NULL;
+    return -1;
 }
 
 static void opt_write_n(uint8_t **opt, uint8_t cmd, size_t n, const void *data) {
@@ -180,115 +218,299 @@ static void opt_write_u32(uint8_t **opt, uint8_t cmd, uint32_t val) {
     *opt = o;
 }
 
+// Lease table: every lease is either on the free list, in a MAC hash chain
+// (offered/bound) or parked after a DECLINE. The reaper timer returns expired
+// leases to the free list.
+
+static uint32_t mac_hash(const uint8_t *mac) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < MAC_LEN; ++i) {
+        h = (h ^ mac[i]) * 16777619u;
+    }
+    return h & (DHCPS_HASH_BUCKETS - 1);
+}
+
+static int lease_find(dhcp_server_t *d, const uint8_t *mac) {
+    for (uint8_t i = d->bucket[mac_hash(mac)]; i != DHCPS_NO_LEASE; i = d->lease[i].next) {
+        if (memcmp(d->lease[i].mac, mac, MAC_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void lease_unlink(dhcp_server_t *d, int yi) {
+    uint8_t *link = &d->bucket[mac_hash(d->lease[yi].mac)];
+    while (*link != DHCPS_NO_LEASE && *link != yi) {
+        link = &d->lease[*link].next;
+    }
+    if (*link == yi) {
+        *link = d->lease[yi].next;
+    }
+}
+
+static void lease_free(dhcp_server_t *d, int yi) {
+    dhcp_server_lease_t *l = &d->lease[yi];
+    if (l->state == DHCPS_LEASE_OFFERED || l->state == DHCPS_LEASE_BOUND) {
+        lease_unlink(d, yi);
+    }
+    memset(l->mac, 0, MAC_LEN);
+    l->state = DHCPS_LEASE_FREE;
+    l->next = d->free_head;
+    d->free_head = yi;
+}
+
+// Take a specific lease off the free list; false if it isn't free
+static bool lease_take_free(dhcp_server_t *d, int yi) {
+    uint8_t *link = &d->free_head;
+    while (*link != DHCPS_NO_LEASE && *link != yi) {
+        link = &d->lease[*link].next;
+    }
+    if (*link != yi) {
+        return false;
+    }
+    *link = d->lease[yi].next;
+    return true;
+}
+
+// Give lease yi (already off the free list) to mac
+static void lease_assign(dhcp_server_t *d, int yi, const uint8_t *mac, uint8_t state, uint32_t hold_s) {
+    dhcp_server_lease_t *l = &d->lease[yi];
+    uint8_t *head = &d->bucket[mac_hash(mac)];
+    memcpy(l->mac, mac, MAC_LEN);
+    l->state = state;
+    l->expiry = cyw43_hal_ticks_ms() + hold_s * 1000;
+    l->next = *head;
+    *head = yi;
+}
+
+static void lease_set(dhcp_server_t *d, int yi, uint8_t state, uint32_t hold_s) {
+    d->lease[yi].state = state;
+    d->lease[yi].expiry = cyw43_hal_ticks_ms() + hold_s * 1000;
+}
+
+static void lease_reap(dhcp_server_t *d) {
+    uint32_t now = cyw43_hal_ticks_ms();
+    for (int i = 0; i < DHCPS_MAX_IP; ++i) {
+        if (d->lease[i].state != DHCPS_LEASE_FREE && (int32_t)(d->lease[i].expiry - now) <= 0) {
+            lease_free(d, i);
+        }
+    }
+}
+
+static void lease_reap_timer(void *arg) {
+    dhcp_server_t *d = arg;
+    lease_reap(d);
+    sys_timeout(DHCPS_REAP_INTERVAL_MS, lease_reap_timer, d);
+}
+
+static void lease_table_init(dhcp_server_t *d) {
+    memset(d->lease, 0, sizeof(d->lease));
+    memset(d->bucket, DHCPS_NO_LEASE, sizeof(d->bucket));
+    d->free_head = DHCPS_NO_LEASE;
+    // lowest addresses are handed out first
+    for (int i = DHCPS_MAX_IP - 1; i >= 0; --i) {
+        d->lease[i].next = d->free_head;
+        d->free_head = i;
+    }
+}
+
+static bool opt_is_addr(const struct pbuf *p, int o, const ip_addr_t *ip) {
+    uint8_t a[4];
+    return pbuf_get_at(p, o + 1) == 4 && pbuf_copy_partial(p, a, 4, o + 2) == 4 &&
+           memcmp(a, &ip4_addr_get_u32(ip_2_ip4(ip)), 4) == 0;
+}
+
+// The reply buffer is reused once lwIP has let go of the previous reply
+static struct pbuf *reply_acquire(dhcp_server_t *d) {
+    if (d->reply != NULL && d->reply->ref == 1) {
+        // udp_sendto() leaves payload pointing at the link header
+        d->reply->payload = d->reply_payload;
+        d->reply->len = d->reply->tot_len = DHCPS_REPLY_MAX;
+        return d->reply;
+    }
+    return pbuf_alloc(PBUF_TRANSPORT, DHCPS_REPLY_MAX, PBUF_RAM);
+}
+
 static void dhcp_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *src_addr, u16_t src_port) {
     dhcp_server_t *d = arg;
     (void)upcb;
     (void)src_addr;
     (void)src_port;
 
-    // This is around 548 bytes
-    dhcp_msg_t dhcp_msg;
+    // fixed fields up to chaddr; options are read from the pbuf in place
+    uint8_t hdr[MSG_OFS(sname)];
+    const uint8_t *ciaddr = hdr + MSG_OFS(ciaddr);
+    const uint8_t *chaddr = hdr + MSG_OFS(chaddr);
 
-    #define DHCP_MIN_SIZE (240 + 3)
     if (p->tot_len < DHCP_MIN_SIZE) {
         goto ignore_request;
     }
+    pbuf_copy_partial(p, hdr, sizeof(hdr), 0);
 
-    size_t len = pbuf_copy_partial(p, &dhcp_msg, sizeof(dhcp_msg), 0);
-    if (len < DHCP_MIN_SIZE) {
-        goto ignore_request;
-    }
-
-    dhcp_msg.op = DHCPOFFER;
-    memcpy(&dhcp_msg.yiaddr, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 4);
-
-    uint8_t *opt = (uint8_t *)&dhcp_msg.options;
-    opt += 4; // assume magic cookie: 99, 130, 83, 99
-
-    uint8_t *msgtype = opt_find(opt, DHCP_OPT_MSG_TYPE);
-    if (msgtype == NULL) {
+    // assume magic cookie: 99, 130, 83, 99
+    int mt = opt_find(p, DHCP_OPT_MSG_TYPE);
+    if (mt < 0) {
         // A DHCP package without MSG_TYPE?
         goto ignore_request;
     }
+    uint8_t msgtype = pbuf_get_at(p, mt + 2);
 
-    switch (msgtype[2]) {
+    int yi = -1;
+    uint8_t reply_type = 0;
+    bool rapid = false;
+    switch (msgtype) {
         case DHCPDISCOVER: {
-            int yi = DHCPS_MAX_IP;
-            for (int i = 0; i < DHCPS_MAX_IP; ++i) {
-                if (memcmp(d->lease[i].mac, dhcp_msg.chaddr, MAC_LEN) == 0) {
-                    // MAC match, use this IP address
-                    yi = i;
-                    break;
+            yi = lease_find(d, chaddr);
+            if (yi < 0) {
+                if (d->free_head == DHCPS_NO_LEASE) {
+                    lease_reap(d);
                 }
-                if (yi == DHCPS_MAX_IP) {
-                    // Look for a free IP address
-                    if (memcmp(d->lease[i].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) {
-                        // IP available
-                        yi = i;
-                    }
-                    uint32_t expiry = d->lease[i].expiry << 16 | 0xffff;
-                    if ((int32_t)(expiry - cyw43_hal_ticks_ms()) < 0) {
-                        // IP expired, reuse it
-                        memset(d->lease[i].mac, 0, MAC_LEN);
-                        yi = i;
-                    }
+                if (d->free_head == DHCPS_NO_LEASE) {
+                    // No more IP addresses left
+                    printf("DHCPS: no free lease for %02x:%02x:%02x:%02x:%02x:%02x\n",
+                        chaddr[0], chaddr[1], chaddr[2], chaddr[3], chaddr[4], chaddr[5]);
+                    goto ignore_request;
                 }
+                yi = d->free_head;
+                d->free_head = d->lease[yi].next;
+                lease_assign(d, yi, chaddr, DHCPS_LEASE_OFFERED, DHCPS_OFFER_HOLD_S);
+            } else if (d->lease[yi].state == DHCPS_LEASE_OFFERED) {
+                lease_set(d, yi, DHCPS_LEASE_OFFERED, DHCPS_OFFER_HOLD_S);
             }
-            if (yi == DHCPS_MAX_IP) {
-                // No more IP addresses left
-                goto ignore_request;
+            #if DHCPS_RAPID_COMMIT
+            if (opt_find(p, DHCP_OPT_RAPID_COMMIT) >= 0) {
+                // two-message exchange: bind now and skip OFFER/REQUEST
+                lease_set(d, yi, DHCPS_LEASE_BOUND, DEFAULT_LEASE_TIME_S);
+                reply_type = DHCPACK;
+                rapid = true;
+                break;
             }
-            dhcp_msg.yiaddr[3] = DHCPS_BASE_IP + yi;
-            opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPOFFER);
+            #endif
+            reply_type = DHCPOFFER;
             break;
         }
 
         case DHCPREQUEST: {
-            uint8_t *o = opt_find(opt, DHCP_OPT_REQUESTED_IP);
-            if (o == NULL) {
-                // Should be NACK
+            int sid = opt_find(p, DHCP_OPT_SERVER_ID);
+            if (sid >= 0 && !opt_is_addr(p, sid, &d->ip)) {
+                // the client took another server's offer: release ours
+                yi = lease_find(d, chaddr);
+                if (yi >= 0 && d->lease[yi].state == DHCPS_LEASE_OFFERED) {
+                    lease_free(d, yi);
+                }
                 goto ignore_request;
             }
-            if (memcmp(o + 2, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 3) != 0) {
-                // Should be NACK
-                goto ignore_request;
+            uint8_t req[4];
+            int o = opt_find(p, DHCP_OPT_REQUESTED_IP);
+            if (o >= 0 && pbuf_get_at(p, o + 1) == 4) {
+                pbuf_copy_partial(p, req, 4, o + 2);
+            } else {
+                // renewing clients put their address in ciaddr instead
+                memcpy(req, ciaddr, 4);
             }
-            uint8_t yi = o[5] - DHCPS_BASE_IP;
-            if (yi >= DHCPS_MAX_IP) {
-                // Should be NACK
-                goto ignore_request;
+            yi = req[3] - DHCPS_BASE_IP;
+            if (memcmp(req, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 3) != 0 || yi < 0 || yi >= DHCPS_MAX_IP) {
+                // not one of ours (e.g. INIT-REBOOT from another network)
+                reply_type = DHCPNACK;
+                break;
             }
-            if (memcmp(d->lease[yi].mac, dhcp_msg.chaddr, MAC_LEN) == 0) {
+            int cur = lease_find(d, chaddr);
+            if (cur == yi) {
                 // MAC match, ok to use this IP address
-            } else if (memcmp(d->lease[yi].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) {
-                // IP unused, ok to use this IP address
-                memcpy(d->lease[yi].mac, dhcp_msg.chaddr, MAC_LEN);
+            } else if (lease_take_free(d, yi)) {
+                // IP unused, ok to use this IP address; drop whatever we offered before
+                if (cur >= 0) {
+                    lease_free(d, cur);
+                }
+                lease_assign(d, yi, chaddr, DHCPS_LEASE_BOUND, DEFAULT_LEASE_TIME_S);
             } else {
                 // IP already in use
-                // Should be NACK
-                goto ignore_request;
+                reply_type = DHCPNACK;
+                break;
             }
-            d->lease[yi].expiry = (cyw43_hal_ticks_ms() + DEFAULT_LEASE_TIME_S * 1000) >> 16;
-            dhcp_msg.yiaddr[3] = DHCPS_BASE_IP + yi;
-            opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPACK);
-            printf("DHCPS: client connected: MAC=%02x:%02x:%02x:%02x:%02x:%02x IP=%u.%u.%u.%u\n",
-                dhcp_msg.chaddr[0], dhcp_msg.chaddr[1], dhcp_msg.chaddr[2], dhcp_msg.chaddr[3], dhcp_msg.chaddr[4], dhcp_msg.chaddr[5],
-                dhcp_msg.yiaddr[0], dhcp_msg.yiaddr[1], dhcp_msg.yiaddr[2], dhcp_msg.yiaddr[3]);
+            lease_set(d, yi, DHCPS_LEASE_BOUND, DEFAULT_LEASE_TIME_S);
+            reply_type = DHCPACK;
             break;
         }
 
+        case DHCPDECLINE: {
+            // the client found the address in use (ARP probe): park it
+            yi = lease_find(d, chaddr);
+            if (yi >= 0) {
+                lease_unlink(d, yi);
+                memset(d->lease[yi].mac, 0, MAC_LEN);
+                lease_set(d, yi, DHCPS_LEASE_DECLINED, DHCPS_DECLINE_HOLD_S);
+            }
+            goto ignore_request;
+        }
+
+        case DHCPRELEASE: {
+            yi = lease_find(d, chaddr);
+            if (yi >= 0) {
+                lease_free(d, yi);
+            }
+            goto ignore_request;
+        }
+
         default:
             goto ignore_request;
     }
 
+    struct pbuf *out = reply_acquire(d);
+    if (out == NULL) {
+        goto ignore_request;
+    }
+    uint8_t *r = (uint8_t *)out->payload;
+    memset(r, 0, DHCPS_REPLY_MAX);
+    r[MSG_OFS(op)] = BOOTREPLY;
+    memcpy(r + MSG_OFS(htype), hdr + MSG_OFS(htype), MSG_OFS(secs) - MSG_OFS(htype)); // htype, hlen, hops, xid
+    memcpy(r + MSG_OFS(flags), hdr + MSG_OFS(flags), 2);
+    if (reply_type != DHCPNACK) {
+        memcpy(r + MSG_OFS(ciaddr), ciaddr, 4);
+        memcpy(r + MSG_OFS(yiaddr), &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 3);
+        r[MSG_OFS(yiaddr) + 3] = DHCPS_BASE_IP + yi;
+    }
+    memcpy(r + MSG_OFS(giaddr), hdr + MSG_OFS(giaddr), 4 + sizeof(((dhcp_msg_t *)0)->chaddr)); // giaddr, chaddr
+    memcpy(r + MSG_OFS(options), "\x63\x82\x53\x63", 4);
+
+    uint8_t *opt = r + DHCP_OPTIONS_OFS;
+    opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, reply_type);
     opt_write_n(&opt, DHCP_OPT_SERVER_ID, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip)));
-    opt_write_n(&opt, DHCP_OPT_SUBNET_MASK, 4, &ip4_addr_get_u32(ip_2_ip4(&d->nm)));
-    opt_write_n(&opt, DHCP_OPT_ROUTER, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // aka gateway; can have multiple addresses
-    opt_write_n(&opt, DHCP_OPT_DNS, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // this server is the dns
-    opt_write_u32(&opt, DHCP_OPT_IP_LEASE_TIME, DEFAULT_LEASE_TIME_S);
+    if (reply_type != DHCPNACK) {
+        if (rapid) {
+            *opt++ = DHCP_OPT_RAPID_COMMIT;
+            *opt++ = 0;
+        }
+        opt_write_n(&opt, DHCP_OPT_SUBNET_MASK, 4, &ip4_addr_get_u32(ip_2_ip4(&d->nm)));
+        opt_write_n(&opt, DHCP_OPT_ROUTER, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // aka gateway; can have multiple addresses
+        opt_write_n(&opt, DHCP_OPT_DNS, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // this server is the dns
+        opt_write_u32(&opt, DHCP_OPT_IP_LEASE_TIME, DEFAULT_LEASE_TIME_S);
+        if (d->captive_uri[0]) {
+            // RFC 8910: lets clients find the portal API without probing
+            opt_write_n(&opt, DHCP_OPT_CAPTIVE_URI, strlen(d->captive_uri), d->captive_uri);
+        }
+    }
     *opt++ = DHCP_OPT_END;
+    size_t len = opt - r;
+    if (len < BOOTP_MIN_LEN) {
+        len = BOOTP_MIN_LEN;
+    }
+
+    if (reply_type == DHCPNACK) {
+        printf("DHCPS: NAK to %02x:%02x:%02x:%02x:%02x:%02x\n",
+            chaddr[0], chaddr[1], chaddr[2], chaddr[3], chaddr[4], chaddr[5]);
+    } else if (reply_type == DHCPACK) {
+        printf("DHCPS: client connected%s: MAC=%02x:%02x:%02x:%02x:%02x:%02x IP=%u.%u.%u.%u\n", rapid ? " (rapid commit)" : "",
+            chaddr[0], chaddr[1], chaddr[2], chaddr[3], chaddr[4], chaddr[5],
+            r[MSG_OFS(yiaddr)], r[MSG_OFS(yiaddr) + 1], r[MSG_OFS(yiaddr) + 2], r[MSG_OFS(yiaddr) + 3]);
+    }
+
     struct netif *nif = ip_current_input_netif();
-    dhcp_socket_sendto(&d->udp, nif, &dhcp_msg, opt - (uint8_t *)&dhcp_msg, 0xffffffff, PORT_DHCP_CLIENT);
+    dhcp_socket_sendto(&d->udp, nif, out, len, 0xffffffff, PORT_DHCP_CLIENT);
+    if (out != d->reply) {
+        pbuf_free(out);
+    }
 
 ignore_request:
     pbuf_free(p);
@@ -297,13 +519,33 @@ ignore_request:
 void dhcp_server_init(dhcp_server_t *d, ip_addr_t *ip, ip_addr_t *nm) {
     ip_addr_copy(d->ip, *ip);
     ip_addr_copy(d->nm, *nm);
-    memset(d->lease, 0, sizeof(d->lease));
+    lease_table_init(d);
+    d->captive_uri[0] = '\0';
+    d->reply = pbuf_alloc(PBUF_TRANSPORT, DHCPS_REPLY_MAX, PBUF_RAM);
+    d->reply_payload = d->reply != NULL ? d->reply->payload : NULL;
     if (dhcp_socket_new_dgram(&d->udp, d, dhcp_server_process) != 0) {
         return;
     }
     dhcp_socket_bind(&d->udp, PORT_DHCP_SERVER);
+    sys_timeout(DHCPS_REAP_INTERVAL_MS, lease_reap_timer, d);
 }
 
 void dhcp_server_deinit(dhcp_server_t *d) {
+    sys_untimeout(lease_reap_timer, d);
     dhcp_socket_free(&d->udp);
+    if (d->reply != NULL) {
+        pbuf_free(d->reply);
+        d->reply = NULL;
+    }
+}
+
+void dhcp_server_set_captive_uri(dhcp_server_t *d, const char *uri) {
+    size_t n = uri != NULL ? strlen(uri) : 0;
+    if (n >= sizeof(d->captive_uri)) {
+        n = 0; // a truncated URI is worse than none
+    }
+    if (n > 0) {
+        memcpy(d->captive_uri, uri, n);
+    }
+    d->captive_uri[n] = '\0';
 }
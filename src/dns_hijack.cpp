@@ -1,36 +1,295 @@
+#include "dns_hijack.h"
 #include "lwip/udp.h"
+#include "lwip/pbuf.h"
 #include "lwip/ip_addr.h"
+#include "lwip/sys.h"
 #include <string.h>
 
+#ifndef DNS_HIJACK_TTL_S
+// short, so clients drop the hijacked answers soon after leaving the AP
+#define DNS_HIJACK_TTL_S 60
+#endif
+
+#ifndef DNS_RESP_POOL_SIZE
+// replies that can't be built in the received pbuf come from here
+#define DNS_RESP_POOL_SIZE 4
+#endif
+
+#ifndef DNS_RL_CLIENTS
+// per-source rate limit slots, least recently seen is reclaimed when full
+#define DNS_RL_CLIENTS 16
+#endif
+
+#ifndef DNS_RL_BURST
+#define DNS_RL_BURST 20         // queries a client may send back to back
+#endif
+
+#ifndef DNS_RL_RATE
+#define DNS_RL_RATE 10          // sustained queries per second, 0 = no limit
+#endif
+
+#define DNS_HDR_LEN       12
+#define DNS_MAX_NAME      255
+#define DNS_EDNS_UDP_SIZE 512
+
+#define DNS_FLAG_QR       0x8000
+#define DNS_FLAG_AA       0x0400
+#define DNS_FLAG_RD       0x0100
+#define DNS_FLAG_RA       0x0080
+
+#define DNS_RCODE_NOERROR  0
+#define DNS_RCODE_FORMERR  1
+#define DNS_RCODE_NOTIMP   4
+#define DNS_RCODE_BADVERS  16   // extended, carried in the OPT record
+
+#define DNS_TYPE_A        1
+#define DNS_TYPE_OPT      41
+#define DNS_TYPE_ANY      255
+#define DNS_CLASS_IN      1
+#define DNS_CLASS_ANY     255
+
+#define DNS_ANSWER_LEN    16    // name pointer, type, class, ttl, rdlen, IPv4
+#define DNS_OPT_LEN       11    // root name, type, size, ext-rcode/version/flags, rdlen
+#define DNS_RESP_MAX      (DNS_HDR_LEN + DNS_MAX_NAME + 1 + 4 + DNS_ANSWER_LEN + DNS_OPT_LEN)
+
 static struct udp_pcb *dns_pcb;
 static ip4_addr_t ap_ip;
+static DnsHijackStats stats;
+
+struct DnsResp {
+    struct pbuf *p;
+    void *payload;          // udp_sendto() leaves payload at the link header
+};
+static DnsResp resp_pool[DNS_RESP_POOL_SIZE];
+
+struct RateSlot {
+    uint32_t addr;
+    uint32_t tokens;        // in 1/1000 of a query
+    uint32_t last_ms;
+    bool used;              // 0.0.0.0 is a valid source (DHCP clients)
+};
+static RateSlot rate_slots[DNS_RL_CLIENTS];
+static uint32_t rl_burst = DNS_RL_BURST;
+static uint32_t rl_rate = DNS_RL_RATE;
+
+// Token bucket per source address; false if this query is over budget
+static bool rate_allow(const ip_addr_t *addr) {
+    if (!rl_rate) return true;
+    uint32_t a = ip4_addr_get_u32(ip_2_ip4(addr));
+    uint32_t now = sys_now();
+    RateSlot *slot = nullptr, *lru = &rate_slots[0];
+    for (auto &r : rate_slots) {
+        if (r.used && r.addr == a) { slot = &r; break; }
+        if (!r.used) { lru = &r; continue; }
+        if (lru->used && (int32_t)(r.last_ms - lru->last_ms) < 0) lru = &r;
+    }
+    if (!slot) {
+        if (lru->used) stats.rl_evictions++;
+        slot = lru;
+        slot->used = true;
+        slot->addr = a;
+        slot->tokens = rl_burst * 1000;
+    } else {
+        uint32_t elapsed = now - slot->last_ms;
+        uint32_t cap = rl_burst * 1000;
+        // 64-bit so a large rate or a long idle gap can't wrap the refill
+        uint64_t refill = (uint64_t)elapsed * rl_rate;
+        slot->tokens = refill >= cap - slot->tokens ? cap : slot->tokens + (uint32_t)refill;
+    }
+    slot->last_ms = now;
+    if (slot->tokens < 1000) return false;
+    slot->tokens -= 1000;
+    return true;
+}
+
+struct DnsQuery {
+    uint16_t id;
+    uint16_t flags;
+    uint16_t question_len;  // QNAME+QTYPE+QCLASS at DNS_HDR_LEN, 0 if not echoed
+    uint16_t qtype;
+    uint16_t qclass;
+    bool has_opt;           // client sent EDNS, so we answer with an OPT record
+    uint16_t rcode;
+};
+
+static uint16_t get_u16(const struct pbuf *p, uint16_t off) {
+    return (uint16_t)(pbuf_get_at(p, off) << 8 | pbuf_get_at(p, off + 1));
+}
+
+// Offset just past the name at off, or -1. Compression is only allowed when
+// allow_ptr is set (never in the question of a query).
+static int skip_name(const struct pbuf *p, int off, bool allow_ptr) {
+    int start = off;
+    while (true) {
+        int len = pbuf_try_get_at(p, off);
+        if (len < 0) return -1;
+        if (len == 0) return off + 1;
+        if ((len & 0xC0) == 0xC0) {
+            if (!allow_ptr || pbuf_try_get_at(p, off + 1) < 0) return -1;
+            return off + 2;
+        }
+        if (len & 0xC0) return -1;
+        off += 1 + len;
+        if (off - start > DNS_MAX_NAME) return -1;
+    }
+}
+
+// Fills q from the query in p. Returns false if the packet should be dropped
+// silently (too short for a header, or not a query).
+static bool dns_parse(const struct pbuf *p, DnsQuery &q) {
+    memset(&q, 0, sizeof(q));
+    if (p->tot_len < DNS_HDR_LEN) return false;
+    q.id = get_u16(p, 0);
+    q.flags = get_u16(p, 2);
+    if (q.flags & DNS_FLAG_QR) return false;
+
+    uint16_t qdcount = get_u16(p, 4);
+    uint16_t ancount = get_u16(p, 6);
+    uint16_t nscount = get_u16(p, 8);
+    uint16_t arcount = get_u16(p, 10);
+
+    if ((q.flags >> 11) & 0xF) { q.rcode = DNS_RCODE_NOTIMP; return true; }
+    if (qdcount != 1) { q.rcode = DNS_RCODE_FORMERR; return true; }
+
+    int off = skip_name(p, DNS_HDR_LEN, false);
+    if (off < 0 || off + 4 > p->tot_len) { q.rcode = DNS_RCODE_FORMERR; return true; }
+    q.qtype = get_u16(p, off);
+    q.qclass = get_u16(p, off + 2);
+    off += 4;
+    q.question_len = off - DNS_HDR_LEN;
+
+    // look for an OPT record in the additional section
+    for (int i = 0; i < ancount + nscount + arcount; i++) {
+        off = skip_name(p, off, true);
+        if (off < 0 || off + 10 > p->tot_len) { q.rcode = DNS_RCODE_FORMERR; return true; }
+        uint16_t type = get_u16(p, off);
+        uint16_t rdlen = get_u16(p, off + 8);
+        if (type == DNS_TYPE_OPT && i >= ancount + nscount) {
+            q.has_opt = true;
+            uint8_t version = pbuf_get_at(p, off + 5);
+            if (version != 0) q.rcode = DNS_RCODE_BADVERS;
+        }
+        off += 10 + rdlen;
+    }
+    return true;
+}
+
+static bool dns_wants_answer(const DnsQuery &q) {
+    if (q.rcode != DNS_RCODE_NOERROR) return false;
+    // AAAA, HTTPS, SVCB etc. get an empty NOERROR so clients move on to A
+    return (q.qtype == DNS_TYPE_A || q.qtype == DNS_TYPE_ANY) &&
+           (q.qclass == DNS_CLASS_IN || q.qclass == DNS_CLASS_ANY);
+}
+
+static uint16_t dns_reply_len(const DnsQuery &q) {
+    return DNS_HDR_LEN + q.question_len +
+           (dns_wants_answer(q) ? DNS_ANSWER_LEN : 0) +
+           (q.has_opt ? DNS_OPT_LEN : 0);
+}
+
+// Header, answer and OPT into out; the question must already sit at DNS_HDR_LEN
+static void dns_write_reply(struct pbuf *out, const DnsQuery &q) {
+    bool answer = dns_wants_answer(q);
+    uint16_t flags = DNS_FLAG_QR | (q.flags & 0x7800) | DNS_FLAG_AA |
+                     (q.flags & DNS_FLAG_RD) | DNS_FLAG_RA | (q.rcode & 0xF);
+    uint8_t hdr[DNS_HDR_LEN] = {
+        (uint8_t)(q.id >> 8), (uint8_t)q.id,
+        (uint8_t)(flags >> 8), (uint8_t)flags,
+        0, (uint8_t)(q.question_len ? 1 : 0),
+        0, (uint8_t)(answer ? 1 : 0),
+        0, 0,
+        0, (uint8_t)(q.has_opt ? 1 : 0),
+    };
+    pbuf_take_at(out, hdr, sizeof(hdr), 0);
+
+    uint16_t off = DNS_HDR_LEN + q.question_len;
+    if (answer) {
+        uint8_t ans[DNS_ANSWER_LEN] = {0xC0,0x0C, 0x00,DNS_TYPE_A, 0x00,DNS_CLASS_IN,
+                                       (uint8_t)(DNS_HIJACK_TTL_S >> 24), (uint8_t)(DNS_HIJACK_TTL_S >> 16),
+                                       (uint8_t)(DNS_HIJACK_TTL_S >> 8), (uint8_t)DNS_HIJACK_TTL_S,
+                                       0x00,0x04,
+                                       (uint8_t)ip4_addr1(&ap_ip),(uint8_t)ip4_addr2(&ap_ip),
+                                       (uint8_t)ip4_addr3(&ap_ip),(uint8_t)ip4_addr4(&ap_ip)};
+        pbuf_take_at(out, ans, sizeof(ans), off);
+        off += sizeof(ans);
+    }
+    if (q.has_opt) {
+        uint8_t opt[DNS_OPT_LEN] = {0x00, 0x00,DNS_TYPE_OPT,
+                                    (uint8_t)(DNS_EDNS_UDP_SIZE >> 8), (uint8_t)DNS_EDNS_UDP_SIZE,
+                                    (uint8_t)(q.rcode >> 4), 0x00, 0x00, 0x00,
+                                    0x00, 0x00};
+        pbuf_take_at(out, opt, sizeof(opt), off);
+    }
+}
+
+// The query can be overwritten with the reply if nobody else holds it and the
+// reply fits in what it already occupies; a longer reply goes to resp_pool
+static bool fits_in_place(const struct pbuf *p, uint16_t len) {
+    return !p->next && p->ref == 1 && len <= p->len;
+}
+
+static struct pbuf *resp_acquire() {
+    for (auto &r : resp_pool) {
+        // lwIP may still hold the last reply, e.g. queued behind ARP
+        if (r.p && r.p->ref == 1) {
+            r.p->payload = r.payload;
+            return r.p;
+        }
+    }
+    return nullptr;
+}
 
 static void dns_recv(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    (void)arg;
     if (!p) return;
-    // Minimal parse: echo header, set response bit and one answer, point to our IP
-    uint8_t hdr[12];
-    if (p->len < 12) { pbuf_free(p); return; }
-    pbuf_copy_partial(p, hdr, 12, 0);
-    hdr[2] |= 0x80;        // QR=1 (response)
-    hdr[3] |= 0x80;        // RA=1
-    // set ANCOUNT=1
-    hdr[6] = 0; hdr[7] = 1;
-    struct pbuf *out = pbuf_alloc(PBUF_TRANSPORT, p->tot_len + 16, PBUF_RAM);
-    if (!out) { pbuf_free(p); return; }
-    // copy original query
-    pbuf_take(out, p->payload, p->tot_len);
-    // append minimal answer: pointer to name (0xC0,0x0C), type A(1), class IN(1), TTL 60, RDLEN 4, RDATA ip
-    uint8_t ans[16] = {0xC0,0x0C, 0x00,0x01, 0x00,0x01, 0x00,0x00,0x00,0x3C, 0x00,0x04,
-                       (uint8_t)ip4_addr1(&ap_ip),(uint8_t)ip4_addr2(&ap_ip),
-                       (uint8_t)ip4_addr3(&ap_ip),(uint8_t)ip4_addr4(&ap_ip)};
-    pbuf_take_at(out, ans, sizeof(ans), p->tot_len);
-    udp_sendto(upcb, out, addr, port);
-    pbuf_free(out);
+    stats.queries++;
+    if (!rate_allow(addr)) {
+        stats.dropped_ratelimit++;
+        pbuf_free(p);
+        return;
+    }
+    DnsQuery q;
+    if (!dns_parse(p, q)) {
+        stats.dropped_invalid++;
+        pbuf_free(p);
+        return;
+    }
+
+    uint16_t len = dns_reply_len(q);
+    struct pbuf *out = nullptr;
+    bool owned = false;     // out must be freed after sending
+    if (fits_in_place(p, len)) {
+        // the question already sits at DNS_HDR_LEN, anything after it is replaced
+        out = p;
+        stats.replies_inplace++;
+    } else {
+        if ((out = resp_acquire()) != nullptr) {
+            stats.replies_pool++;
+        } else if ((out = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM)) != nullptr) {
+            owned = true;
+            stats.replies_alloc++;
+        } else {
+            stats.dropped_nomem++;
+            pbuf_free(p);
+            return;
+        }
+        // works for chained queries too, out is always a single pbuf
+        pbuf_copy_partial(p, (uint8_t*)out->payload + DNS_HDR_LEN, q.question_len, DNS_HDR_LEN);
+    }
+    out->len = out->tot_len = len;
+    dns_write_reply(out, q);
+    if (udp_sendto(upcb, out, addr, port) != ERR_OK) stats.send_errors++;
+    if (owned) pbuf_free(out);
     pbuf_free(p);
 }
 
 void dns_hijack_start(ip4_addr_t ip) {
     ap_ip = ip;
+    for (auto &r : resp_pool) {
+        if (!r.p) r.p = pbuf_alloc(PBUF_TRANSPORT, DNS_RESP_MAX, PBUF_RAM);
+        if (r.p) r.payload = r.p->payload;
+    }
+    memset(rate_slots, 0, sizeof(rate_slots));
     dns_pcb = udp_new();
     udp_bind(dns_pcb, IP_ANY_TYPE, 53);
     udp_recv(dns_pcb, dns_recv, nullptr);
@@ -38,4 +297,18 @@ void dns_hijack_start(ip4_addr_t ip) {
 
 void dns_hijack_stop() {
     if (dns_pcb) { udp_remove(dns_pcb); dns_pcb = nullptr; }
-}
\ No newline at end of file
+    for (auto &r : resp_pool) {
+        if (r.p) { pbuf_free(r.p); r.p = nullptr; }
+    }
+}
+
+const DnsHijackStats &dns_hijack_stats() {
+    return stats;
+}
+
+void dns_hijack_set_rate_limit(uint32_t burst, uint32_t per_second) {
+    // buckets count in 1/1000 of a query
+    rl_burst = burst ? (burst < UINT32_MAX / 1000 ? burst : UINT32_MAX / 1000) : 1;
+    rl_rate = per_second;
+    memset(rate_slots, 0, sizeof(rate_slots));
+}
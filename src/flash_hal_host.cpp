@@ -0,0 +1,128 @@
+// Host (Linux) flash backend: a region-sized file mapped with mmap, used by
+// the benchmarks in bench/. Enforces the same alignment and NOR rules as the
+// device, models latency and wear, and can inject power loss mid-operation.
+#include "flash_hal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint8_t *region;
+static int region_fd = -1;
+static FlashHalHostStats stats;
+static uint32_t erase_us = 45000;       // typical 4 KB sector erase
+static uint32_t page_us = 700;          // typical 256 B page program
+static uint32_t fail_countdown;         // 0 = no failure armed
+static uint32_t fail_torn_bytes;
+static bool powered_off;
+
+bool flash_hal_host_open(const char *path) {
+    flash_hal_host_close();
+    region_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (region_fd < 0) {
+        perror("flash_hal_host_open");
+        return false;
+    }
+    struct stat st;
+    bool fresh = fstat(region_fd, &st) == 0 && st.st_size != CREDS_FLASH_SIZE;
+    if (fresh && ftruncate(region_fd, CREDS_FLASH_SIZE) != 0) {
+        perror("ftruncate");
+        return false;
+    }
+    void *m = mmap(nullptr, CREDS_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, region_fd, 0);
+    if (m == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    region = (uint8_t*)m;
+    if (fresh) memset(region, 0xFF, CREDS_FLASH_SIZE);
+    powered_off = false;
+    fail_countdown = 0;
+    return true;
+}
+
+void flash_hal_host_close() {
+    if (region) munmap(region, CREDS_FLASH_SIZE);
+    if (region_fd >= 0) close(region_fd);
+    region = nullptr;
+    region_fd = -1;
+}
+
+void flash_hal_host_set_timing(uint32_t erase, uint32_t page_program) {
+    erase_us = erase;
+    page_us = page_program;
+}
+
+void flash_hal_host_fail_after(uint32_t nth_op, uint32_t torn_bytes) {
+    fail_countdown = nth_op;
+    fail_torn_bytes = torn_bytes;
+}
+
+void flash_hal_host_power_cycle() {
+    powered_off = false;
+    fail_countdown = 0;
+}
+
+const FlashHalHostStats &flash_hal_host_stats() {
+    return stats;
+}
+
+void flash_hal_host_reset_stats() {
+    memset(&stats, 0, sizeof(stats));
+}
+
+static void account(uint32_t us) {
+    stats.busy_us += us;
+    if (us > stats.max_irq_off_us) stats.max_irq_off_us = us;
+}
+
+// true if this operation is the one the power fails in
+static bool power_fails_now() {
+    return fail_countdown && --fail_countdown == 0;
+}
+
+const uint8_t *flash_hal_ptr(uint32_t off) {
+    return region + off;
+}
+
+bool flash_hal_erase(uint32_t off) {
+    if (!region || powered_off) return false;
+    if (off % FLASH_SECTOR_SIZE || off + FLASH_SECTOR_SIZE > CREDS_FLASH_SIZE) {
+        fprintf(stderr, "flash_hal: misaligned erase at 0x%x\n", (unsigned)off);
+        return false;
+    }
+    stats.erases++;
+    stats.sector_erases[off / FLASH_SECTOR_SIZE]++;
+    account(erase_us);
+    if (power_fails_now()) {
+        // half erased: the low half is blank, the high half keeps whatever it had
+        memset(region + off, 0xFF, FLASH_SECTOR_SIZE / 2);
+        powered_off = true;
+        return false;
+    }
+    memset(region + off, 0xFF, FLASH_SECTOR_SIZE);
+    return true;
+}
+
+bool flash_hal_program(uint32_t off, const uint8_t *data, uint32_t len) {
+    if (!region || powered_off) return false;
+    if (off % FLASH_PAGE_SIZE || len % FLASH_PAGE_SIZE || off + len > CREDS_FLASH_SIZE) {
+        fprintf(stderr, "flash_hal: misaligned program at 0x%x len %u\n", (unsigned)off, (unsigned)len);
+        return false;
+    }
+    stats.programs++;
+    stats.pages_programmed += len / FLASH_PAGE_SIZE;
+    account(page_us * (len / FLASH_PAGE_SIZE));
+    uint32_t n = len;
+    bool fail = power_fails_now();
+    if (fail && fail_torn_bytes < n) n = fail_torn_bytes;
+    // NOR programming can only clear bits
+    for (uint32_t i = 0; i < n; i++) region[off + i] &= data[i];
+    if (fail) {
+        powered_off = true;
+        return false;
+    }
+    return true;
+}
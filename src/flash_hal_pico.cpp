@@ -0,0 +1,41 @@
+#include "flash_hal.h"
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+
+#ifndef CREDS_FLASH_SAFE_TIMEOUT_MS
+// how long to wait for the other core to park before giving up on a write
+#define CREDS_FLASH_SAFE_TIMEOUT_MS 100
+#endif
+
+static_assert(CREDS_FLASH_OFFSET % FLASH_SECTOR_SIZE == 0, "creds region must be sector aligned");
+
+struct FlashOp {
+    uint32_t off;
+    const uint8_t *data;    // nullptr = erase sector
+    uint32_t len;
+};
+
+// Runs with interrupts off and the other core parked (if it opted in with
+// flash_safe_execute_core_init() or uses multicore lockout)
+static void flash_op_run(void *param) {
+    const FlashOp *op = (const FlashOp*)param;
+    if (op->data) {
+        flash_range_program(CREDS_FLASH_OFFSET + op->off, op->data, op->len);
+    } else {
+        flash_range_erase(CREDS_FLASH_OFFSET + op->off, FLASH_SECTOR_SIZE);
+    }
+}
+
+const uint8_t *flash_hal_ptr(uint32_t off) {
+    return (const uint8_t*)(XIP_BASE + CREDS_FLASH_OFFSET + off);
+}
+
+bool flash_hal_erase(uint32_t off) {
+    FlashOp op{off, nullptr, 0};
+    return flash_safe_execute(flash_op_run, &op, CREDS_FLASH_SAFE_TIMEOUT_MS) == PICO_OK;
+}
+
+bool flash_hal_program(uint32_t off, const uint8_t *data, uint32_t len) {
+    FlashOp op{off, data, len};
+    return flash_safe_execute(flash_op_run, &op, CREDS_FLASH_SAFE_TIMEOUT_MS) == PICO_OK;
+}
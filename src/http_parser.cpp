@@ -0,0 +1,329 @@
+#include "http_parser.h"
+#include <string.h>
+
+enum ParseState : uint8_t {
+    S_START,        // optional empty lines before the request line
+    S_METHOD,
+    S_PATH,
+    S_QUERY,
+    S_VERSION,
+    S_HEADER_NAME,
+    S_HEADER_VALUE,
+    S_BODY,
+    S_DONE,
+    S_ERROR,
+};
+
+enum HeaderId : uint8_t {
+    H_OTHER,
+    H_CONTENT_LENGTH,
+    H_CONNECTION,
+    H_IF_NONE_MATCH,
+    H_TRANSFER_ENCODING,
+    H_ACCEPT_ENCODING,
+};
+
+struct HeaderName {
+    const char *name;
+    HeaderId id;
+};
+
+static const HeaderName known_headers[] = {
+    {"content-length",    H_CONTENT_LENGTH},
+    {"connection",        H_CONNECTION},
+    {"if-none-match",     H_IF_NONE_MATCH},
+    {"transfer-encoding", H_TRANSFER_ENCODING},
+    {"accept-encoding",   H_ACCEPT_ENCODING},
+};
+
+struct MethodName {
+    const char *name;
+    HttpMethod method;
+};
+
+static const MethodName methods[] = {
+    {"GET",     HTTP_GET},
+    {"HEAD",    HTTP_HEAD},
+    {"POST",    HTTP_POST},
+    {"PUT",     HTTP_PUT},
+    {"DELETE",  HTTP_DELETE},
+    {"OPTIONS", HTTP_OPTIONS},
+};
+
+void http_parser_init(HttpParser &p) {
+    p.state = S_START;
+    p.header = H_OTHER;
+    p.pos = 0;
+    p.header_bytes = 0;
+    p.error = 0;
+    p.chunked = false;
+    memset(&p.req, 0, offsetof(HttpRequest, body));
+    p.req.body[0] = '\0';
+}
+
+const char *http_method_name(HttpMethod m) {
+    for (const MethodName &n : methods) {
+        if (n.method == m) return n.name;
+    }
+    return "?";
+}
+
+static HttpParseStatus fail(HttpParser &p, uint16_t status) {
+    p.state = S_ERROR;
+    p.error = status;
+    return HTTP_PARSE_ERROR;
+}
+
+static char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+static bool token_eq_ci(const char *a, const char *b) {
+    for (; *a && *b; a++, b++) {
+        if (lower(*a) != *b) return false;
+    }
+    return *a == *b;
+}
+
+// Accept-Encoding: gzip, or * if gzip isn't listed, with q > 0. A list longer
+// than the value buffer loses its tail, like If-None-Match.
+static bool gzip_accepted(const char *v) {
+    int gzip = -1, star = -1;   // -1 not listed, else acceptable
+    while (*v) {
+        while (*v == ' ' || *v == '\t' || *v == ',') v++;
+        const char *name = v;
+        while (*v && *v != ',' && *v != ';' && *v != ' ' && *v != '\t') v++;
+        size_t n = v - name;
+        bool q0 = false;
+        while (*v && *v != ',') {
+            if (*v++ != ';') continue;
+            while (*v == ' ' || *v == '\t') v++;
+            if (lower(v[0]) != 'q' || v[1] != '=') continue;
+            // q=0, q=0.0 ... q=0.000
+            const char *q = v + 2;
+            q0 = *q == '0';
+            for (q++; q0 && *q && *q != ',' && *q != ';' && *q != ' ' && *q != '\t'; q++) q0 = *q == '.' || *q == '0';
+        }
+        if (n == 1 && *name == '*') star = !q0;
+        else if (n == 4 && lower(name[0]) == 'g' && lower(name[1]) == 'z' &&
+                 lower(name[2]) == 'i' && lower(name[3]) == 'p') gzip = !q0;
+    }
+    return gzip >= 0 ? gzip : star > 0;
+}
+
+// A complete header line: act on the ones we track
+static bool apply_header(HttpParser &p) {
+    p.value[p.pos < sizeof(p.value) ? p.pos : sizeof(p.value) - 1] = '\0';
+    // trailing whitespace isn't part of the value
+    for (int i = (int)strlen(p.value) - 1; i >= 0 && (p.value[i] == ' ' || p.value[i] == '\t'); i--) p.value[i] = '\0';
+
+    HttpRequest &r = p.req;
+    switch (p.header) {
+    case H_CONTENT_LENGTH: {
+        uint32_t n = 0;
+        if (!p.value[0]) return false;
+        for (const char *c = p.value; *c; c++) {
+            if (*c < '0' || *c > '9' || n > 100000000) return false;
+            n = n * 10 + (*c - '0');
+        }
+        r.content_length = n;
+        break;
+    }
+    case H_CONNECTION:
+        if (token_eq_ci(p.value, "close")) r.keep_alive = false;
+        else if (token_eq_ci(p.value, "keep-alive")) r.keep_alive = true;
+        break;
+    case H_IF_NONE_MATCH:
+        // only a single tag is matched, a longer list just misses the cache
+        memcpy(r.if_none_match, p.value, sizeof(r.if_none_match));
+        r.if_none_match[sizeof(r.if_none_match) - 1] = '\0';
+        break;
+    case H_TRANSFER_ENCODING:
+        if (!token_eq_ci(p.value, "identity")) p.chunked = true;
+        break;
+    case H_ACCEPT_ENCODING:
+        r.accepts_gzip = gzip_accepted(p.value);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+static HeaderId lookup_header(const char *name) {
+    for (const HeaderName &h : known_headers) {
+        if (!strcmp(h.name, name)) return h.id;
+    }
+    return H_OTHER;
+}
+
+HttpParseStatus http_parser_feed(HttpParser &p, const char *data, size_t len, size_t *used) {
+    HttpRequest &r = p.req;
+    size_t i = 0;
+    *used = 0;
+    if (p.state == S_ERROR) return HTTP_PARSE_ERROR;
+    if (p.state == S_DONE) return HTTP_PARSE_DONE;
+
+    while (i < len) {
+        if (p.state == S_BODY) {
+            // bulk copy, the body can't exceed HTTP_MAX_BODY by now
+            size_t n = r.content_length - r.body_len;
+            if (n > len - i) n = len - i;
+            memcpy(r.body + r.body_len, data + i, n);
+            r.body_len += n;
+            i += n;
+            if (r.body_len == r.content_length) {
+                r.body[r.body_len] = '\0';
+                p.state = S_DONE;
+                *used = i;
+                return HTTP_PARSE_DONE;
+            }
+            continue;
+        }
+        if (p.state == S_HEADER_VALUE && p.header == H_OTHER) {
+            // untracked value: skip to the end of the line in one go
+            const char *nl = (const char*)memchr(data + i, '\n', len - i);
+            size_t n = nl ? (size_t)(nl - (data + i)) : len - i;
+            if (p.header_bytes + n > HTTP_MAX_HEADER_BYTES) {
+                *used = i + n;
+                return fail(p, 431);
+            }
+            p.header_bytes += n;
+            i += n;
+            if (!nl) break;
+        }
+
+        char c = data[i++];
+        if (++p.header_bytes > HTTP_MAX_HEADER_BYTES) {
+            *used = i;
+            return fail(p, 431);
+        }
+
+        switch (p.state) {
+        case S_START:
+            if (c == '\r' || c == '\n') {
+                p.header_bytes = 0;
+                break;
+            }
+            p.state = S_METHOD;
+            p.pos = 0;
+            // fall through
+        case S_METHOD:
+            if (c == ' ') {
+                p.token[p.pos] = '\0';
+                bool found = false;
+                for (const MethodName &m : methods) {
+                    if (!strcmp(m.name, p.token)) { r.method = m.method; found = true; }
+                }
+                if (!found) { *used = i; return fail(p, 501); }
+                p.state = S_PATH;
+                p.pos = 0;
+            } else if (c < 'A' || c > 'Z' || p.pos >= sizeof(p.token) - 1) {
+                *used = i;
+                return fail(p, c == '\r' || c == '\n' ? 400 : 501);
+            } else {
+                p.token[p.pos++] = c;
+            }
+            break;
+
+        case S_PATH:
+            if (c == ' ' || c == '?') {
+                if (p.pos == 0) { *used = i; return fail(p, 400); }
+                r.path[p.pos] = '\0';
+                p.state = c == '?' ? S_QUERY : S_VERSION;
+                p.pos = 0;
+            } else if (c == '\r' || c == '\n') {
+                *used = i;
+                return fail(p, 400);
+            } else if (p.pos >= sizeof(r.path) - 1) {
+                *used = i;
+                return fail(p, 414);
+            } else {
+                r.path[p.pos++] = c;
+            }
+            break;
+
+        case S_QUERY:
+            if (c == ' ') {
+                r.query[p.pos] = '\0';
+                p.state = S_VERSION;
+                p.pos = 0;
+            } else if (c == '\r' || c == '\n') {
+                *used = i;
+                return fail(p, 400);
+            } else if (p.pos >= sizeof(r.query) - 1) {
+                *used = i;
+                return fail(p, 414);
+            } else {
+                r.query[p.pos++] = c;
+            }
+            break;
+
+        case S_VERSION:
+            if (c == '\r') break;
+            if (c == '\n') {
+                p.token[p.pos] = '\0';
+                if (strncmp(p.token, "HTTP/1.", 7) != 0 || p.token[7] < '0' || p.token[7] > '9' || p.token[8]) {
+                    *used = i;
+                    return fail(p, 505);
+                }
+                r.version_minor = p.token[7] - '0';
+                r.keep_alive = r.version_minor >= 1;
+                p.state = S_HEADER_NAME;
+                p.pos = 0;
+            } else if (p.pos >= sizeof(p.token) - 1) {
+                *used = i;
+                return fail(p, 505);
+            } else {
+                p.token[p.pos++] = c;
+            }
+            break;
+
+        case S_HEADER_NAME:
+            if (c == '\r') break;
+            if (c == '\n') {
+                if (p.pos != 0) { *used = i; return fail(p, 400); }
+                // end of headers
+                if (p.chunked) { *used = i; return fail(p, 501); }
+                if (r.content_length > HTTP_MAX_BODY) { *used = i; return fail(p, 413); }
+                *used = i;
+                if (r.content_length == 0) {
+                    p.state = S_DONE;
+                    return HTTP_PARSE_DONE;
+                }
+                p.state = S_BODY;
+                break;
+            }
+            if (c == ':') {
+                p.token[p.pos < sizeof(p.token) ? p.pos : sizeof(p.token) - 1] = '\0';
+                // names longer than the buffer can't be one we track
+                p.header = p.pos < sizeof(p.token) ? lookup_header(p.token) : H_OTHER;
+                p.state = S_HEADER_VALUE;
+                p.pos = 0;
+            } else {
+                if (p.pos < sizeof(p.token)) p.token[p.pos] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+                if (p.pos < UINT16_MAX) p.pos++;
+            }
+            break;
+
+        case S_HEADER_VALUE:
+            if (c == '\r') break;
+            if (c == '\n') {
+                if (!apply_header(p)) { *used = i; return fail(p, 400); }
+                p.state = S_HEADER_NAME;
+                p.header = H_OTHER;
+                p.pos = 0;
+            } else if (p.header != H_OTHER) {
+                if (p.pos == 0 && (c == ' ' || c == '\t')) break;
+                if (p.pos < sizeof(p.value) - 1) p.value[p.pos++] = c;
+                else if (p.header == H_CONTENT_LENGTH) { *used = i; return fail(p, 400); }
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+    *used = i;
+    return HTTP_PARSE_MORE;
+}
@@ -1,48 +1,25 @@
-#include "lwip/tcp.h"
+#include "http_portal.h"
+#include "http_router.h"
 #include <string.h>
 #include <stdio.h>
 #include "creds_store.h"
-
-static const char *PAGE =
-"HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n"
-"<!doctype html><html><body style='font-family:sans-serif'>"
-"<h2>Pico Wi-Fi Setup</h2>"
-"<form method='POST' action='/save'>"
-"SSID:<br><input name='s' maxlength='32'><br>"
-"Password:<br><input name='p' type='password' maxlength='64'><br><br>"
-"Device Hostname:<br><input name='n' maxlength='31'><br><br>"
-"<button type='submit'>Save & Connect</button>"
-"</form></body></html>";
-
-
-static const char *PAGE_HTML =
-"<!doctype html><html><body style='font-family:sans-serif'>"
-"<h2>Pico Wi-Fi Setup</h2>"
-"<form method='POST' action='/save'>"
-"SSID:<br><input name='s' maxlength='32'><br>"
-"Password:<br><input name='p' type='password' maxlength='64'><br><br>"
-"Device Hostname:<br><input name='n' maxlength='31'><br><br>"
-"<button type='submit'>Save & Connect</button>"
-"</form></body></html>";
-
-static void send_page(struct tcp_pcb *tpcb) {
-    char hdr[128];
-    snprintf(hdr, sizeof(hdr),
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: text/html\r\n"
-        "Content-Length: %u\r\n"
-        "Connection: close\r\n\r\n",
-        (unsigned)strlen(PAGE_HTML));
-
-    tcp_write(tpcb, hdr, strlen(hdr), TCP_WRITE_FLAG_COPY);
-    tcp_write(tpcb, PAGE_HTML, strlen(PAGE_HTML), TCP_WRITE_FLAG_COPY);
+#include "creds_json.h"
+#include "pico_captive_connect.h"
+#include "scheduler.h"
+#include "wifi_scan.h"
+#include "pico/time.h"
+
+// RFC 8908: tells the client it is captive and where the user portal is
+static void send_captive_api(HttpConn *c) {
+    char body[96];
+    int blen = snprintf(body, sizeof(body),
+        "{\"captive\":true,\"user-portal-url\":\"http://%s/\"}",
+        ipaddr_ntoa(&c->pcb->local_ip));
+    http_send_response(c, 200, "application/captive+json", body, blen,
+                       "Cache-Control: private\r\n");
 }
 
-
-static const char *OK =
-"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nSaved. Connecting…\n";
-
-static err_t on_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) { (void)arg;(void)len; tcp_close(tpcb); return ERR_OK; }
+static const char *OK = "Saved. Connecting…\n";
 
 static void url_decode(char *s) {
     // very small decoder for %XX and + -> space
@@ -57,7 +34,7 @@ static void url_decode(char *s) {
 
 static void parse_and_save(const char *body, size_t len) {
     // parse s=...&p=...
-    char buf[200]; if (len >= sizeof(buf)) len = sizeof(buf)-1;
+    char buf[HTTP_MAX_BODY + 1]; if (len >= sizeof(buf)) len = sizeof(buf)-1;
     memcpy(buf, body, len); buf[len]=0;
     DeviceCreds c{}; c.valid=false;
     char *tok = strtok(buf, "&");
@@ -79,44 +56,187 @@ static void parse_and_save(const char *body, size_t len) {
 
         printf("Saving creds: SSID='%s', PASS='%s', Device Hostname='%s'\n", c.ssid, masked_pass, c.hostname); // <-- debug
         // printf("Saving creds: SSID='%s', PASS='%s'\n", c.ssid, c.wifi_pass); // <-- debug
-        creds_save(c, true); 
+        creds_save_async(c, true); 
+        sched_wake();   // net_task() commits it
     }
 
 }
 
-static err_t on_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
-    if (!p) { tcp_close(tpcb); return ERR_OK; }
-    char req[1024]; size_t n = pbuf_copy_partial(p, req, sizeof(req)-1, 0); req[n]=0;
-    // printf("HTTP request:\n%s\n", req); // <-- dump the full request
+// GET: saved settings, PUT: set them in one go, then reboot into STA mode
+static void on_api_config(HttpConn *c, const HttpRequest &req) {
+    if (req.method == HTTP_PUT) {
+        DeviceCreds n = creds_get();
+        char err[64];
+        int status = creds_json_apply(n, req.body, req.body_len, err, sizeof(err));
+        if (status) {
+            http_send_json_error(c, status, err);
+            return;
+        }
+        if (!n.valid) {
+            http_send_json_error(c, 400, "ssid: required");
+            return;
+        }
+        printf("Saving creds: SSID='%s', Device Hostname='%s'\n", n.ssid, n.hostname);
+        creds_save_async(n, true);
+        sched_wake();   // net_task() commits it
+        char buf[48];
+        JsonWriter w;
+        json_init(w, buf, sizeof(buf));
+        json_object_begin(w);
+        json_bool(w, "saved", true);
+        json_bool(w, "reboot", true);
+        json_object_end(w);
+        http_send_json(c, 200, w);
+        return;
+    }
+    char buf[384];
+    JsonWriter w;
+    json_init(w, buf, sizeof(buf));
+    creds_json_write(w, creds_get());
+    http_send_json(c, 200, w);
+}
 
-    if (!strncmp(req, "GET / ", 6)) {
-        // tcp_write(tpcb, PAGE, strlen(PAGE), TCP_WRITE_FLAG_COPY);
-        send_page(tpcb);
-    } else if (!strncmp(req, "POST /save", 10)) {
-        // find body
-        const char *body = strstr(req, "\r\n\r\n");
-        if (body) {
-            body += 4;
-            parse_and_save(body, strlen(body));
+// Streamed a network at a time: stream_pos 0 is the head, n the n-th network,
+// then the tail. A scan finishing midway still yields well-formed JSON.
+static size_t scan_stream(HttpConn *c, char *buf, size_t room) {
+    const WifiScanTable &t = wifi_scan_results();
+    size_t len = 0;
+    while (c->stream_pos != UINT32_MAX) {
+        JsonWriter w;
+        json_init(w, buf + len, room - len);
+        if (c->stream_pos == 0) {
+            json_object_begin(w);
+            json_bool(w, "scanning", wifi_scan_busy());
+            if (t.generation) {
+                json_uint(w, "age_s", (to_ms_since_boot(get_absolute_time()) - t.updated_ms) / 1000);
+            }
+            json_array_begin(w, "networks");
+        } else if (c->stream_pos <= t.count) {
+            const WifiNetwork &n = t.nets[c->stream_pos - 1];
+            char bssid[18];
+            snprintf(bssid, sizeof(bssid), "%02x:%02x:%02x:%02x:%02x:%02x",
+                     n.bssid[0], n.bssid[1], n.bssid[2], n.bssid[3], n.bssid[4], n.bssid[5]);
+            w.comma = c->stream_pos > 1;
+            json_object_begin(w);
+            json_string(w, "ssid", n.ssid);
+            json_int(w, "rssi", n.rssi);
+            json_string(w, "auth", wifi_auth_name(n.auth));
+            json_uint(w, "channel", n.channel);
+            json_string(w, "bssid", bssid);
+            json_object_end(w);
+        } else {
+            json_array_end(w);
+            json_object_end(w);
         }
-        tcp_write(tpcb, OK, strlen(OK), TCP_WRITE_FLAG_COPY);
-    } else {
-        tcp_write(tpcb, PAGE, strlen(PAGE), TCP_WRITE_FLAG_COPY);
+        if (w.overflow) break;
+        len += w.len;
+        c->stream_pos = c->stream_pos <= t.count ? c->stream_pos + 1 : UINT32_MAX;
+    }
+    if (len) return len;
+    // nothing fit: wait for the next ACK, unless the body is done
+    return c->stream_pos == UINT32_MAX ? 0 : HTTP_STREAM_IDLE;
+}
+
+// GET: networks seen by the last background scan, POST: scan again now
+static void on_api_scan(HttpConn *c, const HttpRequest &req) {
+    if (req.method == HTTP_POST) {
+        wifi_scan_request();
+        char buf[24];
+        JsonWriter w;
+        json_init(w, buf, sizeof(buf));
+        json_object_begin(w);
+        json_bool(w, "scanning", true);
+        json_object_end(w);
+        http_send_json(c, 202, w);
+        return;
     }
-    tcp_output(tpcb);
-    pbuf_free(p);
-    return ERR_OK;
+    http_send_stream(c, 200, "application/json", scan_stream, "Cache-Control: no-store\r\n");
+}
+
+static void on_api_status(HttpConn *c, const HttpRequest &req) {
+    (void)req;
+    char buf[192];
+    JsonWriter w;
+    json_init(w, buf, sizeof(buf));
+    json_object_begin(w);
+    json_string(w, "mode", "ap");
+    json_string(w, "hostname", net_hostname());
+    json_string(w, "ip", ipaddr_ntoa(&c->pcb->local_ip));
+    json_bool(w, "configured", creds_get().valid);
+    json_uint(w, "uptime_s", to_ms_since_boot(get_absolute_time()) / 1000);
+    json_uint(w, "config_generation", creds_generation());
+    json_object_end(w);
+    http_send_json(c, 200, w);
 }
 
-static err_t on_accept(void *arg, struct tcp_pcb *newpcb, err_t err) {
-    tcp_recv(newpcb, on_recv);
-    tcp_sent(newpcb, on_sent);
-    return ERR_OK;
+static void on_captive_api(HttpConn *c, const HttpRequest &req) {
+    (void)req;
+    send_captive_api(c);
 }
 
+static void on_setup_page(HttpConn *c, const HttpRequest &req) {
+    (void)req;
+    const WebAsset *a = web_asset_find("/setup.html");
+    if (a) http_send_asset(c, *a);
+    else http_send_status(c, 404);
+}
+
+static void on_save(HttpConn *c, const HttpRequest &req) {
+    parse_and_save(req.body, req.body_len);
+    http_send_response(c, 200, "text/plain", OK, strlen(OK));
+}
+
+// OS connectivity probes (and anything else unknown) get a redirect to the
+// portal: a detector that doesn't see its expected answer opens the portal
+// right away instead of retrying or waiting on a page it never shows.
+static void on_redirect(HttpConn *c, const HttpRequest &req) {
+    (void)req;
+    char loc[48];
+    snprintf(loc, sizeof(loc), "Location: http://%s/\r\nCache-Control: no-store\r\n", ipaddr_ntoa(&c->pcb->local_ip));
+    http_send_response(c, 302, nullptr, nullptr, 0, loc);
+}
+
+static void on_other(HttpConn *c, const HttpRequest &req) {
+    // files from web/
+    if (const WebAsset *a = web_asset_find(req.path)) http_send_asset(c, *a);
+    else on_redirect(c, req);
+}
+
+static constexpr HttpRoute ROUTES[] = {
+    {"/",                           HTTP_M_GET,         on_setup_page},
+    {"/api/config",                 HTTP_M_GET | HTTP_M(HTTP_PUT), on_api_config},
+    {"/api/scan",                   HTTP_M_GET | HTTP_M(HTTP_POST), on_api_scan},
+    {"/api/status",                 HTTP_M_GET,         on_api_status},
+    {"/canonical.html",             HTTP_M_GET,         on_redirect},       // Firefox
+    {HTTP_PORTAL_CAPTIVE_API_PATH,  HTTP_M_GET,         on_captive_api},
+    {"/connecttest.txt",            HTTP_M_GET,         on_redirect},       // Windows 10+
+    {"/gen_204",                    HTTP_M_GET,         on_redirect},       // Android, ChromeOS
+    {"/generate_204",               HTTP_M_GET,         on_redirect},       // Android, ChromeOS
+    {"/hotspot-detect.html",        HTTP_M_GET,         on_redirect},       // Apple
+    {"/kindle-wifi/wifistub.html",  HTTP_M_GET,         on_redirect},       // Kindle
+    {"/library/test/success.html",  HTTP_M_GET,         on_redirect},       // Apple (older)
+    {"/ncsi.txt",                   HTTP_M_GET,         on_redirect},       // Windows
+    {"/redirect",                   HTTP_M_GET,         on_redirect},       // Windows
+    {"/save",                       HTTP_M(HTTP_POST),  on_save},
+    {"/success.txt",                HTTP_M_GET,         on_redirect},       // Firefox
+};
+HTTP_ROUTER(router, "AP HTTP", ROUTES, on_other);
+
+static void on_request(HttpConn *c, const HttpRequest &req) {
+    http_route(router, c, req);
+}
+
+static HttpServer server = {"AP HTTP", on_request, nullptr};
+
 void http_portal_start() {
-    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
-    tcp_bind(pcb, IP_ANY_TYPE, 80);
-    pcb = tcp_listen_with_backlog(pcb, 2);
-    tcp_accept(pcb, on_accept);
+    http_server_start(server, IP_ANY_TYPE, 80);
+}
+
+void http_portal_stop() {
+    http_server_stop(server);
+}
+
+void http_portal_print_stats() {
+    http_server_print_stats(server);
+    http_router_print_stats(router);
 }
@@ -0,0 +1,46 @@
+#include "http_router.h"
+#include <stdio.h>
+#include <string.h>
+
+static int route_find(const HttpRouter &r, const char *path) {
+    int lo = 0, hi = r.count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = http_path_cmp(path, r.routes[mid].path);
+        if (cmp == 0) return mid;
+        if (cmp < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return -1;
+}
+
+void http_route(const HttpRouter &r, HttpConn *c, const HttpRequest &req) {
+    int i = route_find(r, req.path);
+    if (i < 0) {
+        r.hits[r.count]++;
+        r.fallback(c, req);
+        return;
+    }
+    r.hits[i]++;
+    const HttpRoute &route = r.routes[i];
+    if (route.methods & HTTP_M(req.method)) {
+        route.fn(c, req);
+        return;
+    }
+    char allow[64] = "Allow: ";
+    for (int m = HTTP_GET; m <= HTTP_OPTIONS; m++) {
+        if (!(route.methods & HTTP_M(m))) continue;
+        if (allow[7]) strcat(allow, ", ");
+        strcat(allow, http_method_name((HttpMethod)m));
+    }
+    strcat(allow, "\r\n");
+    http_send_response(c, 405, "text/plain", "Method Not Allowed", 18, allow);
+}
+
+void http_router_print_stats(const HttpRouter &r) {
+    printf("%s routes:\n", r.name);
+    for (unsigned i = 0; i < r.count; i++) {
+        printf("  %-28s %lu\n", r.routes[i].path, (unsigned long)r.hits[i]);
+    }
+    printf("  %-28s %lu\n", "(other)", (unsigned long)r.hits[r.count]);
+}
@@ -0,0 +1,587 @@
+#include "http_server.h"
+#include <stdio.h>
+#include <string.h>
+
+static HttpConn conns[HTTP_MAX_CONNS];
+
+const char *http_status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 406: return "Not Acceptable";
+    case 408: return "Request Timeout";
+    case 413: return "Content Too Large";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default:  return "";
+    }
+}
+
+#define HTTP_POLL_INTERVAL 2     // tcp_poll ticks are 500 ms
+
+// A response body is still being produced
+static bool conn_sending(const HttpConn *c) {
+    return c->tx_len || c->stream;
+}
+
+static uint32_t conn_rx_held(const HttpConn *c) {
+    return c->rx ? c->rx->tot_len : 0;
+}
+
+static void rx_drop(HttpConn *c) {
+    if (!c->rx) return;
+    if (c->pcb) tcp_recved(c->pcb, c->rx->tot_len);
+    pbuf_free(c->rx);
+    c->rx = nullptr;
+}
+
+static void conn_release(HttpConn *c) {
+    c->pcb = nullptr;
+    c->server->stats.active--;
+}
+
+// Detach and close; ERR_ABRT if the pcb had to be aborted instead
+static err_t conn_close(HttpConn *c) {
+    struct tcp_pcb *pcb = c->pcb;
+    if (!pcb) return ERR_OK;
+    rx_drop(c);
+    conn_release(c);
+    tcp_arg(pcb, nullptr);
+    tcp_recv(pcb, nullptr);
+    tcp_sent(pcb, nullptr);
+    tcp_err(pcb, nullptr);
+    tcp_poll(pcb, nullptr, 0);
+    if (tcp_close(pcb) != ERR_OK) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+static HttpConn *conn_alloc() {
+    for (HttpConn &c : conns) {
+        if (!c.pcb) return &c;
+    }
+    // all busy: make room by dropping the longest idle keep-alive connection
+    HttpConn *victim = nullptr;
+    for (HttpConn &c : conns) {
+        if (c.closing || c.rx || conn_sending(&c) || tcp_sndqueuelen(c.pcb)) continue;
+        if (!victim || c.idle_s > victim->idle_s) victim = &c;
+    }
+    if (victim) {
+        victim->server->stats.evicted++;
+        conn_close(victim);
+    }
+    return victim;
+}
+
+// ---- Load shedding: over the cap a client gets a canned 503, not a reset ----
+
+static const char RESP_BUSY[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 5\r\n"
+    "Retry-After: 2\r\n"
+    "Connection: close\r\n\r\n"
+    "Busy\n";
+
+static uint8_t shed_active;
+
+static err_t shed_close(struct tcp_pcb *pcb) {
+    shed_active--;
+    tcp_arg(pcb, nullptr);
+    tcp_recv(pcb, nullptr);
+    tcp_sent(pcb, nullptr);
+    tcp_err(pcb, nullptr);
+    tcp_poll(pcb, nullptr, 0);
+    if (tcp_close(pcb) != ERR_OK) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+static err_t shed_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+    (void)arg; (void)err;
+    if (!p) return shed_close(tpcb);
+    // the request is never read
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t shed_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    (void)arg; (void)len;
+    return tcp_sndqueuelen(tpcb) == 0 ? shed_close(tpcb) : ERR_OK;
+}
+
+static err_t shed_poll(void *arg, struct tcp_pcb *tpcb) {
+    (void)arg;
+    // shed_err does the accounting
+    tcp_abort(tpcb);
+    return ERR_ABRT;
+}
+
+static void shed_err(void *arg, err_t err) {
+    (void)arg; (void)err;
+    shed_active--;
+}
+
+static err_t shed(HttpServer *s, struct tcp_pcb *pcb) {
+    s->stats.shed++;
+    // the canned reply is referenced, not copied
+    if (shed_active >= HTTP_MAX_SHED || tcp_write(pcb, RESP_BUSY, sizeof(RESP_BUSY) - 1, 0) != ERR_OK) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    shed_active++;
+    tcp_arg(pcb, nullptr);
+    tcp_recv(pcb, shed_recv);
+    tcp_sent(pcb, shed_sent);
+    tcp_err(pcb, shed_err);
+    // a peer that never reads the reply is dropped after ~4 s
+    tcp_poll(pcb, shed_poll, 4 * HTTP_POLL_INTERVAL);
+    tcp_output(pcb);
+    return ERR_OK;
+}
+
+// Release n parsed bytes from the head of the held input and reopen the window
+static void rx_consume(HttpConn *c, u16_t n) {
+    tcp_recved(c->pcb, n);
+    if (n < c->rx->len) {
+        pbuf_remove_header(c->rx, n);
+        return;
+    }
+    struct pbuf *next = c->rx->next;
+    if (next) pbuf_ref(next);
+    pbuf_free(c->rx);
+    c->rx = next;
+}
+
+static bool conn_drained(HttpConn *c) {
+    return !conn_sending(c) && tcp_sndqueuelen(c->pcb) == 0;
+}
+
+// Queue as much of the pending body as the send buffer takes. A flash body is
+// referenced, not copied, so it goes out straight from XIP flash; a streamed
+// one is rendered chunk by chunk into the send buffer.
+static void conn_flush(HttpConn *c) {
+    while (c->tx_len) {
+        u16_t room = tcp_sndbuf(c->pcb);
+        if (!room || tcp_sndqueuelen(c->pcb) >= TCP_SND_QUEUELEN - 1) break;
+        u16_t n = c->tx_len < room ? c->tx_len : room;
+        err_t e = tcp_write(c->pcb, c->tx, n, c->tx_len > n ? TCP_WRITE_FLAG_MORE : 0);
+        if (e == ERR_MEM) break;            // more room after the next ACK
+        if (e != ERR_OK) {
+            printf("%s: tcp_write failed err=%d\n", c->server->name, e);
+            c->tx_len = 0;
+            c->closing = true;
+            break;
+        }
+        c->tx += n;
+        c->tx_len -= n;
+    }
+    while (c->stream && !c->tx_len) {
+        u16_t room = tcp_sndbuf(c->pcb);
+        if (room < HTTP_CHUNK_MIN || tcp_sndqueuelen(c->pcb) >= TCP_SND_QUEUELEN - 1) break;
+        // chunk size line goes in front of the data, CRLF after it
+        char buf[6 + HTTP_CHUNK_MAX + 2];
+        char *data = buf + 6;
+        size_t n = c->stream(c, data, room - 8 < HTTP_CHUNK_MAX ? room - 8 : HTTP_CHUNK_MAX);
+        if (n == HTTP_STREAM_IDLE) break;
+        const char *out = data;
+        size_t len = n;
+        if (c->chunked) {
+            if (n) {
+                char size[8];
+                int k = snprintf(size, sizeof(size), "%x\r\n", (unsigned)n);
+                out = data - k;
+                memcpy(data - k, size, k);
+                memcpy(data + n, "\r\n", 2);
+                len = k + n + 2;
+            } else {
+                out = "0\r\n\r\n";
+                len = 5;
+            }
+        }
+        if (!n) c->stream = nullptr;
+        if (!len) break;
+        // room was checked, so a failure here is lwIP out of memory; the
+        // rendered chunk can't be taken back, so give up on the response
+        err_t e = tcp_write(c->pcb, out, len, TCP_WRITE_FLAG_COPY);
+        if (e != ERR_OK) {
+            printf("%s: tcp_write failed err=%d\n", c->server->name, e);
+            c->stream = nullptr;
+            c->closing = true;
+            break;
+        }
+    }
+    tcp_output(c->pcb);
+}
+
+// Parse and answer held requests in order. Stops when the send buffer is too
+// full for another response; on_sent() picks up from there.
+static err_t conn_process(HttpConn *c) {
+    while (!c->closing) {
+        // with nothing held this only reports a request still waiting for room
+        size_t used;
+        HttpParseStatus st = c->rx ? http_parser_feed(c->parser, (const char*)c->rx->payload, c->rx->len, &used)
+                                   : http_parser_feed(c->parser, nullptr, 0, &used);
+        if (st == HTTP_PARSE_MORE) {
+            if (!c->rx) break;
+            rx_consume(c, c->rx->len);
+            continue;
+        }
+        if (used) rx_consume(c, used);
+        if (st == HTTP_PARSE_ERROR) {
+            printf("%s: bad request (%u)\n", c->server->name, c->parser.error);
+            c->parser.req.keep_alive = false;
+            http_send_status(c, c->parser.error);
+            break;
+        }
+        if (conn_sending(c) || tcp_sndbuf(c->pcb) < HTTP_RESPONSE_ROOM || tcp_sndqueuelen(c->pcb) > TCP_SND_QUEUELEN / 2) {
+            return ERR_OK;
+        }
+        c->server->handler(c, c->parser.req);
+        http_parser_init(c->parser);
+    }
+    // nothing after the last response is read
+    if (c->closing) rx_drop(c);
+    if (c->closing && conn_drained(c)) return conn_close(c);
+    return ERR_OK;
+}
+
+static void on_err(void *arg, err_t err) {
+    (void)err;
+    // lwIP has already freed the pcb
+    HttpConn *c = (HttpConn*)arg;
+    if (!c || !c->pcb) return;
+    conn_release(c);
+    if (c->rx) {
+        pbuf_free(c->rx);
+        c->rx = nullptr;
+    }
+}
+
+static err_t on_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+    HttpConn *c = (HttpConn*)arg;
+    if (!c) return ERR_OK;
+    (void)tpcb; (void)len;
+    c->idle_s = 0;
+    conn_flush(c);
+    // close only once everything queued has been acked, not on the first ACK
+    if (c->closing) return conn_drained(c) ? conn_close(c) : ERR_OK;
+    return conn_process(c);
+}
+
+static err_t on_poll(void *arg, struct tcp_pcb *tpcb) {
+    HttpConn *c = (HttpConn*)arg;
+    if (!c) return tcp_close(tpcb);
+    c->idle_s += HTTP_POLL_INTERVAL / 2;
+    if (c->idle_s >= HTTP_IDLE_TIMEOUT_S) {
+        // idle keep-alive, or a peer that stopped reading
+        if (c->closing || c->rx || !conn_drained(c)) {
+            printf("%s: connection stalled, closing\n", c->server->name);
+            c->server->stats.reaped_stalled++;
+        } else {
+            c->server->stats.reaped_idle++;
+        }
+        return conn_close(c);
+    }
+    // a write that failed for lack of memory, not room, isn't retried by on_sent
+    if (conn_sending(c)) conn_flush(c);
+    return ERR_OK;
+}
+
+static err_t on_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+    HttpConn *c = (HttpConn*)arg;
+    if (!p) {               // remote closed
+        return c ? conn_close(c) : tcp_close(tpcb);
+    }
+    if (err != ERR_OK || !c) {
+        pbuf_free(p);
+        return ERR_OK;
+    }
+    if (c->closing) {
+        tcp_recved(tpcb, p->tot_len);
+        pbuf_free(p);
+        return ERR_OK;
+    }
+    // Input held while responses wait is bounded per connection and overall.
+    // Refusing leaves the data with lwIP, which offers it again later; the
+    // window stays shut meanwhile, so the sender backs off.
+    if (c->rx) {
+        uint32_t total = p->tot_len;
+        for (const HttpConn &o : conns) {
+            if (o.pcb) total += conn_rx_held(&o);
+        }
+        if (conn_rx_held(c) + p->tot_len > HTTP_RX_HOLD_MAX || total > HTTP_RX_BUDGET) {
+            c->server->stats.rx_throttled++;
+            return ERR_MEM;
+        }
+    }
+    c->idle_s = 0;
+    // the chain is parsed in place; it is only held while responses wait for room
+    if (c->rx) pbuf_cat(c->rx, p);
+    else c->rx = p;
+    return conn_process(c);
+}
+
+static err_t on_accept(void *arg, struct tcp_pcb *newpcb, err_t err) {
+    HttpServer *s = (HttpServer*)arg;
+    if (err != ERR_OK || !newpcb) return ERR_VAL;
+    HttpConn *c = conn_alloc();
+    if (!c) {
+        printf("%s: busy, shedding connection\n", s->name);
+        return shed(s, newpcb);
+    }
+    c->pcb = newpcb;
+    c->server = s;
+    s->stats.accepted++;
+    if (++s->stats.active > s->stats.peak) s->stats.peak = s->stats.active;
+    c->rx = nullptr;
+    c->tx = nullptr;
+    c->tx_len = 0;
+    c->stream = nullptr;
+    c->idle_s = 0;
+    c->closing = false;
+    http_parser_init(c->parser);
+
+    tcp_arg(newpcb, c);
+    tcp_recv(newpcb, on_recv);
+    tcp_sent(newpcb, on_sent);
+    tcp_err(newpcb, on_err);
+    tcp_poll(newpcb, on_poll, HTTP_POLL_INTERVAL);
+    return ERR_OK;
+}
+
+bool http_server_start(HttpServer &s, const ip_addr_t *addr, uint16_t port) {
+    if (s.listen_pcb) return true;
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        printf("%s: tcp_new failed\n", s.name);
+        return false;
+    }
+    err_t e = tcp_bind(pcb, addr, port);
+    if (e != ERR_OK) {
+        printf("%s: tcp_bind failed err=%d\n", s.name, e);
+        tcp_close(pcb);
+        return false;
+    }
+    struct tcp_pcb *lpcb = tcp_listen_with_backlog(pcb, HTTP_MAX_CONNS);
+    if (!lpcb) {
+        printf("%s: tcp_listen failed\n", s.name);
+        tcp_close(pcb);
+        return false;
+    }
+    s.listen_pcb = lpcb;
+    tcp_arg(lpcb, &s);
+    tcp_accept(lpcb, on_accept);
+    return true;
+}
+
+void http_server_stop(HttpServer &s) {
+    if (s.listen_pcb) {
+        tcp_arg(s.listen_pcb, nullptr);
+        tcp_accept(s.listen_pcb, nullptr);
+        tcp_close(s.listen_pcb);
+        s.listen_pcb = nullptr;
+    }
+    for (HttpConn &c : conns) {
+        if (c.pcb && c.server == &s) conn_close(&c);
+    }
+}
+
+uint32_t http_conn_mem(const HttpConn &c) {
+    if (!c.pcb) return 0;
+    return conn_rx_held(&c) + (TCP_SND_BUF - tcp_sndbuf(c.pcb));
+}
+
+uint8_t http_conn_index(const HttpConn *c) {
+    return (uint8_t)(c - conns);
+}
+
+void http_server_print_stats(const HttpServer &s) {
+    const HttpServerStats &st = s.stats;
+    printf("%s: active=%u peak=%u accepted=%lu shed=%lu evicted=%lu idle=%lu stalled=%lu throttled=%lu\n",
+           s.name, st.active, st.peak, (unsigned long)st.accepted, (unsigned long)st.shed,
+           (unsigned long)st.evicted, (unsigned long)st.reaped_idle, (unsigned long)st.reaped_stalled,
+           (unsigned long)st.rx_throttled);
+    for (const HttpConn &c : conns) {
+        if (!c.pcb || c.server != &s) continue;
+        printf("  %s:%u mem=%lu rx=%lu idle=%us%s\n", ipaddr_ntoa(&c.pcb->remote_ip), c.pcb->remote_port,
+               (unsigned long)http_conn_mem(c), (unsigned long)conn_rx_held(&c), c.idle_s,
+               c.closing ? " closing" : "");
+    }
+}
+
+// Connection header(s) and the blank line ending the response header
+static int conn_header(HttpConn *c, char *buf, size_t size) {
+    if (!c->parser.req.keep_alive) return snprintf(buf, size, "Connection: close\r\n\r\n");
+    return snprintf(buf, size, "Connection: keep-alive\r\nKeep-Alive: timeout=%u\r\n\r\n", (unsigned)HTTP_IDLE_TIMEOUT_S);
+}
+
+// Status line through the blank line; -1 (and the connection closing) if it didn't fit
+static int build_header(HttpConn *c, char *hdr, size_t size, int status, const char *content_type,
+                        const char *length, const char *extra_headers) {
+    char conn[64];
+    conn_header(c, conn, sizeof(conn));
+    int n = snprintf(hdr, size,
+        "HTTP/1.1 %d %s\r\n"
+        "%s%s%s"
+        "%s"
+        "%s"
+        "%s",
+        status, http_status_text(status),
+        content_type ? "Content-Type: " : "", content_type ? content_type : "", content_type ? "\r\n" : "",
+        length,
+        extra_headers ? extra_headers : "",
+        conn);
+    if (n < 0 || n >= (int)size) {
+        printf("%s: response header truncated\n", c->server->name);
+        c->closing = true;
+        return -1;
+    }
+    return n;
+}
+
+bool http_send_response(HttpConn *c, int status, const char *content_type,
+                        const void *body, size_t len, const char *extra_headers) {
+    if (!c->pcb) return false;
+    char clen[32] = "";
+    // 204 and 304 have no body, and no length to announce
+    if (status != 204 && status != 304) snprintf(clen, sizeof(clen), "Content-Length: %u\r\n", (unsigned)len);
+    char hdr[256];
+    int n = build_header(c, hdr, sizeof(hdr), status, content_type, clen, extra_headers);
+    if (n < 0) return false;
+    // HEAD gets the headers (with the real length) but no body
+    bool with_body = len && c->parser.req.method != HTTP_HEAD;
+    err_t e = tcp_write(c->pcb, hdr, n, TCP_WRITE_FLAG_COPY | (with_body ? TCP_WRITE_FLAG_MORE : 0));
+    if (e == ERR_OK && with_body) e = tcp_write(c->pcb, body, len, TCP_WRITE_FLAG_COPY);
+    tcp_output(c->pcb);
+    if (!c->parser.req.keep_alive || e != ERR_OK) c->closing = true;
+    if (e != ERR_OK) printf("%s: tcp_write failed err=%d\n", c->server->name, e);
+    return e == ERR_OK;
+}
+
+bool http_send_stream(HttpConn *c, int status, const char *content_type,
+                      http_stream_fn fn, const char *extra_headers) {
+    if (!c->pcb) return false;
+    // HTTP/1.0 has no chunked encoding; closing the connection ends the body
+    c->chunked = c->parser.req.version_minor >= 1;
+    if (!c->chunked) c->parser.req.keep_alive = false;
+    char hdr[256];
+    int n = build_header(c, hdr, sizeof(hdr), status, content_type,
+                         c->chunked ? "Transfer-Encoding: chunked\r\n" : "", extra_headers);
+    if (n < 0) return false;
+    err_t e = tcp_write(c->pcb, hdr, n, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+    if (e != ERR_OK) {
+        printf("%s: tcp_write failed err=%d\n", c->server->name, e);
+        c->closing = true;
+        tcp_output(c->pcb);
+        return false;
+    }
+    if (c->parser.req.method != HTTP_HEAD) c->stream = fn;
+    c->stream_pos = 0;
+    if (!c->parser.req.keep_alive) c->closing = true;
+    conn_flush(c);
+    return true;
+}
+
+uint16_t http_stream_kick(HttpServer &s, http_stream_fn fn) {
+    uint16_t n = 0;
+    for (HttpConn &c : conns) {
+        if (!c.pcb || c.server != &s || c.stream != fn) continue;
+        n++;
+        conn_flush(&c);
+    }
+    return n;
+}
+
+uint16_t http_stream_count(const HttpServer &s, http_stream_fn fn) {
+    uint16_t n = 0;
+    for (const HttpConn &c : conns) {
+        if (c.pcb && c.server == &s && c.stream == fn) n++;
+    }
+    return n;
+}
+
+static size_t tpl_stream(HttpConn *c, char *buf, size_t room) {
+    return tpl_render(c->tpl, buf, room);
+}
+
+bool http_send_template(HttpConn *c, int status, const char *content_type,
+                        const TplPart *parts, tpl_value_fn value, const void *ctx) {
+    tpl_begin(c->tpl, parts, value, ctx);
+    return http_send_stream(c, status, content_type, tpl_stream);
+}
+
+const WebAsset *web_asset_find(const char *path) {
+    for (unsigned i = 0; i < web_asset_count; i++) {
+        if (!strcmp(web_assets[i].path, path)) return &web_assets[i];
+    }
+    return nullptr;
+}
+
+bool http_send_asset(HttpConn *c, const WebAsset &a) {
+    if (!c->pcb) return false;
+    const HttpRequest &req = c->parser.req;
+    if (req.if_none_match[0] && (!strcmp(req.if_none_match, a.etag) || !strcmp(req.if_none_match, "*"))) {
+        char extra[HTTP_MAX_ETAG + 72];
+        snprintf(extra, sizeof(extra), "ETag: %s\r\nCache-Control: no-cache\r\nVary: Accept-Encoding\r\n", a.etag);
+        return http_send_response(c, 304, nullptr, nullptr, 0, extra);
+    }
+    // only the gzip'd copy is in flash
+    if (!req.accepts_gzip) return http_send_status(c, 406);
+    // header and body are referenced in flash; only the Connection lines are copied
+    char conn[64];
+    int n = conn_header(c, conn, sizeof(conn));
+    err_t e = tcp_write(c->pcb, a.header, a.header_len, TCP_WRITE_FLAG_MORE);
+    if (e == ERR_OK) e = tcp_write(c->pcb, conn, n, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+    if (e != ERR_OK) {
+        printf("%s: tcp_write failed err=%d\n", c->server->name, e);
+        c->closing = true;
+        tcp_output(c->pcb);
+        return false;
+    }
+    if (req.method != HTTP_HEAD) {
+        c->tx = a.data;
+        c->tx_len = a.len;
+    }
+    if (!req.keep_alive) c->closing = true;
+    conn_flush(c);
+    return true;
+}
+
+bool http_send_status(HttpConn *c, int status) {
+    const char *text = http_status_text(status);
+    return http_send_response(c, status, "text/plain", text, strlen(text));
+}
+
+bool http_send_json(HttpConn *c, int status, const JsonWriter &w) {
+    if (w.overflow) {
+        printf("%s: JSON response too large\n", c->server->name);
+        return http_send_status(c, 500);
+    }
+    return http_send_response(c, status, "application/json", w.buf, w.len, "Cache-Control: no-store\r\n");
+}
+
+bool http_send_json_error(HttpConn *c, int status, const char *message) {
+    char buf[128];
+    JsonWriter w;
+    json_init(w, buf, sizeof(buf));
+    json_object_begin(w);
+    json_string(w, "error", message ? message : http_status_text(status));
+    json_object_end(w);
+    return http_send_json(c, status, w);
+}
@@ -0,0 +1,51 @@
+#include "http_template.h"
+#include <string.h>
+
+void tpl_begin(TplCursor &t, const TplPart *parts, tpl_value_fn value, const void *ctx) {
+    t.part = parts;
+    t.off = 0;
+    t.value = value;
+    t.ctx = ctx;
+}
+
+static const char *html_escape(char c) {
+    switch (c) {
+    case '&':  return "&amp;";
+    case '<':  return "&lt;";
+    case '>':  return "&gt;";
+    case '"':  return "&quot;";
+    case '\'': return "&#39;";
+    default:   return nullptr;
+    }
+}
+
+size_t tpl_render(TplCursor &t, char *buf, size_t room) {
+    size_t n = 0;
+    while (t.part->field != TPL_DONE) {
+        const TplPart &p = *t.part;
+        if (p.field == TPL_LITERAL) {
+            size_t k = p.len - t.off;
+            if (k > room - n) k = room - n;
+            memcpy(buf + n, p.text + t.off, k);
+            n += k;
+            t.off += k;
+            if (t.off < p.len) return n;
+        } else {
+            char scratch[16];
+            const char *v = t.value(t.ctx, p.field, scratch, sizeof(scratch));
+            // the value is fetched again on every pass; if it shrank meanwhile, move on
+            size_t vlen = v ? strlen(v) : 0;
+            for (; t.off < vlen; t.off++) {
+                const char *esc = html_escape(v[t.off]);
+                size_t k = esc ? strlen(esc) : 1;
+                if (k > room - n) return n;
+                if (esc) memcpy(buf + n, esc, k);
+                else buf[n] = v[t.off];
+                n += k;
+            }
+        }
+        t.part++;
+        t.off = 0;
+    }
+    return n;
+}
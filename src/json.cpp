@@ -0,0 +1,355 @@
+#include "json.h"
+#include <string.h>
+#include <stdio.h>
+
+// ---- Writer ----
+
+void json_init(JsonWriter &w, char *buf, size_t size) {
+    w.buf = buf;
+    w.size = size;
+    w.len = 0;
+    w.overflow = size == 0;
+    w.comma = false;
+    if (size) buf[0] = '\0';
+}
+
+static void put(JsonWriter &w, const char *s, size_t n) {
+    if (w.overflow) return;
+    if (w.len + n >= w.size) {
+        w.overflow = true;
+        return;
+    }
+    memcpy(w.buf + w.len, s, n);
+    w.len += n;
+    w.buf[w.len] = '\0';
+}
+
+static void put_escaped(JsonWriter &w, const char *s) {
+    put(w, "\"", 1);
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        put(w, run, s - run);
+        char esc[8];
+        switch (c) {
+        case '"':  put(w, "\\\"", 2); break;
+        case '\\': put(w, "\\\\", 2); break;
+        case '\n': put(w, "\\n", 2); break;
+        case '\r': put(w, "\\r", 2); break;
+        case '\t': put(w, "\\t", 2); break;
+        default:
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            put(w, esc, 6);
+            break;
+        }
+        run = s + 1;
+    }
+    put(w, run, s - run);
+    put(w, "\"", 1);
+}
+
+// Separator and key ahead of a value
+static void prefix(JsonWriter &w, const char *key) {
+    if (w.comma) put(w, ",", 1);
+    if (key) {
+        put_escaped(w, key);
+        put(w, ":", 1);
+    }
+}
+
+void json_object_begin(JsonWriter &w, const char *key) {
+    prefix(w, key);
+    put(w, "{", 1);
+    w.comma = false;
+}
+
+void json_object_end(JsonWriter &w) {
+    put(w, "}", 1);
+    w.comma = true;
+}
+
+void json_array_begin(JsonWriter &w, const char *key) {
+    prefix(w, key);
+    put(w, "[", 1);
+    w.comma = false;
+}
+
+void json_array_end(JsonWriter &w) {
+    put(w, "]", 1);
+    w.comma = true;
+}
+
+void json_string(JsonWriter &w, const char *key, const char *value) {
+    prefix(w, key);
+    put_escaped(w, value ? value : "");
+    w.comma = true;
+}
+
+void json_int(JsonWriter &w, const char *key, int32_t value) {
+    char num[12];
+    prefix(w, key);
+    put(w, num, snprintf(num, sizeof(num), "%ld", (long)value));
+    w.comma = true;
+}
+
+void json_uint(JsonWriter &w, const char *key, uint32_t value) {
+    char num[12];
+    prefix(w, key);
+    put(w, num, snprintf(num, sizeof(num), "%lu", (unsigned long)value));
+    w.comma = true;
+}
+
+void json_bool(JsonWriter &w, const char *key, bool value) {
+    prefix(w, key);
+    if (value) put(w, "true", 4);
+    else put(w, "false", 5);
+    w.comma = true;
+}
+
+// ---- Reader ----
+
+enum ReaderState : uint8_t {
+    R_START,        // before '{'
+    R_FIRST,        // after '{'
+    R_NEXT,         // after a member
+    R_END,
+};
+
+void json_reader_init(JsonReader &r, const char *data, size_t len) {
+    r.p = data;
+    r.end = data + len;
+    r.state = R_START;
+    r.error = false;
+}
+
+static bool fail(JsonReader &r) {
+    r.error = true;
+    r.state = R_END;
+    return false;
+}
+
+static void skip_ws(JsonReader &r) {
+    while (r.p < r.end && (*r.p == ' ' || *r.p == '\t' || *r.p == '\r' || *r.p == '\n')) r.p++;
+}
+
+static bool expect(JsonReader &r, char c) {
+    skip_ws(r);
+    if (r.p == r.end || *r.p != c) return false;
+    r.p++;
+    return true;
+}
+
+static bool literal(JsonReader &r, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(r.end - r.p) < n || memcmp(r.p, word, n) != 0) return false;
+    r.p += n;
+    return true;
+}
+
+static int hex4(const char *p) {
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
+    }
+    return v;
+}
+
+// Opening quote already consumed. Bytes that don't fit are dropped whole
+// (a UTF-8 sequence is never split) and reported as truncated.
+static bool read_string(JsonReader &r, char *out, size_t size, size_t *len, bool *truncated) {
+    size_t n = 0;
+    *truncated = false;
+    while (true) {
+        if (r.p == r.end) return false;
+        unsigned char c = *r.p++;
+        char enc[4];
+        size_t k = 1;
+        if (c == '"') break;
+        if (c < 0x20) return false;
+        enc[0] = c;
+        if (c == '\\') {
+            if (r.p == r.end) return false;
+            char e = *r.p++;
+            switch (e) {
+            case '"': case '\\': case '/': enc[0] = e; break;
+            case 'b': enc[0] = '\b'; break;
+            case 'f': enc[0] = '\f'; break;
+            case 'n': enc[0] = '\n'; break;
+            case 'r': enc[0] = '\r'; break;
+            case 't': enc[0] = '\t'; break;
+            case 'u': {
+                if (r.end - r.p < 4) return false;
+                long cp = hex4(r.p);
+                if (cp < 0) return false;
+                r.p += 4;
+                if (cp >= 0xdc00 && cp <= 0xdfff) return false;
+                if (cp >= 0xd800 && cp <= 0xdbff) {
+                    // must be followed by the low half of the pair
+                    if (r.end - r.p < 6 || r.p[0] != '\\' || r.p[1] != 'u') return false;
+                    int lo = hex4(r.p + 2);
+                    if (lo < 0xdc00 || lo > 0xdfff) return false;
+                    r.p += 6;
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                }
+                if (cp < 0x80) {
+                    enc[0] = (char)cp;
+                } else if (cp < 0x800) {
+                    enc[0] = (char)(0xc0 | cp >> 6);
+                    enc[1] = (char)(0x80 | (cp & 0x3f));
+                    k = 2;
+                } else if (cp < 0x10000) {
+                    enc[0] = (char)(0xe0 | cp >> 12);
+                    enc[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+                    enc[2] = (char)(0x80 | (cp & 0x3f));
+                    k = 3;
+                } else {
+                    enc[0] = (char)(0xf0 | cp >> 18);
+                    enc[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+                    enc[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+                    enc[3] = (char)(0x80 | (cp & 0x3f));
+                    k = 4;
+                }
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        if (!*truncated && size && n + k < size) {
+            memcpy(out + n, enc, k);
+            n += k;
+        } else {
+            *truncated = true;
+        }
+    }
+    if (size) out[n] = '\0';
+    *len = n;
+    return true;
+}
+
+static bool read_number(JsonReader &r, JsonValue &v) {
+    bool neg = false;
+    int64_t n = 0;
+    v.integer = true;
+    if (*r.p == '-') {
+        neg = true;
+        r.p++;
+    }
+    const char *digits = r.p;
+    while (r.p < r.end && *r.p >= '0' && *r.p <= '9') {
+        if (n <= INT32_MAX) n = n * 10 + (*r.p - '0');
+        r.p++;
+    }
+    if (r.p == digits || (*digits == '0' && r.p - digits > 1)) return false;
+    if (r.p < r.end && *r.p == '.') {
+        r.p++;
+        v.integer = false;
+        const char *frac = r.p;
+        while (r.p < r.end && *r.p >= '0' && *r.p <= '9') r.p++;
+        if (r.p == frac) return false;
+    }
+    if (r.p < r.end && (*r.p == 'e' || *r.p == 'E')) {
+        r.p++;
+        v.integer = false;
+        if (r.p < r.end && (*r.p == '+' || *r.p == '-')) r.p++;
+        const char *exp = r.p;
+        while (r.p < r.end && *r.p >= '0' && *r.p <= '9') r.p++;
+        if (r.p == exp) return false;
+    }
+    if (neg) n = -n;
+    if (n > INT32_MAX || n < INT32_MIN) v.integer = false;
+    v.num = v.integer ? (int32_t)n : 0;
+    return true;
+}
+
+// Nested object or array, opening bracket already consumed
+static bool skip_nested(JsonReader &r) {
+    int depth = 1;
+    while (r.p < r.end) {
+        char c = *r.p++;
+        if (c == '"') {
+            size_t len;
+            bool truncated;
+            if (!read_string(r, nullptr, 0, &len, &truncated)) return false;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) return true;
+        }
+    }
+    return false;
+}
+
+bool json_next_member(JsonReader &r, char *key, size_t key_size, JsonValue &v, char *str, size_t str_size) {
+    switch (r.state) {
+    case R_START:
+        if (!expect(r, '{')) return fail(r);
+        r.state = R_FIRST;
+        skip_ws(r);
+        if (r.p < r.end && *r.p == '}') {
+            r.p++;
+            r.state = R_END;
+        }
+        break;
+    case R_NEXT:
+        skip_ws(r);
+        if (r.p < r.end && *r.p == '}') {
+            r.p++;
+            r.state = R_END;
+        } else if (!expect(r, ',')) {
+            return fail(r);
+        }
+        break;
+    default:
+        break;
+    }
+    if (r.state == R_END) {
+        // nothing but whitespace may follow the object
+        skip_ws(r);
+        if (r.p != r.end) r.error = true;
+        r.p = r.end;
+        return false;
+    }
+
+    size_t len;
+    bool truncated;
+    if (!expect(r, '"') || !read_string(r, key, key_size, &len, &truncated) || truncated) return fail(r);
+    if (!expect(r, ':')) return fail(r);
+    skip_ws(r);
+    if (r.p == r.end) return fail(r);
+
+    v = JsonValue{};
+    if (str_size) str[0] = '\0';
+    char c = *r.p;
+    bool ok;
+    if (c == '"') {
+        r.p++;
+        v.type = JSON_STRING;
+        ok = read_string(r, str, str_size, &v.len, &v.truncated);
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        v.type = JSON_NUMBER;
+        ok = read_number(r, v);
+    } else if (c == 't' || c == 'f') {
+        v.type = JSON_BOOL;
+        v.b = c == 't';
+        ok = literal(r, v.b ? "true" : "false");
+    } else if (c == 'n') {
+        v.type = JSON_NULL;
+        ok = literal(r, "null");
+    } else if (c == '{' || c == '[') {
+        r.p++;
+        v.type = JSON_OTHER;
+        ok = skip_nested(r);
+    } else {
+        ok = false;
+    }
+    if (!ok) return fail(r);
+    r.state = R_NEXT;
+    return true;
+}
@@ -0,0 +1,473 @@
+#include "kv_store.h"
+#include "crc32.h"
+#include "flash_hal.h"
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CREDS_MAGIC 0x43525749u      // 'I','W','R','C' legacy single-blob image
+#define CREDS_LOG_MAGIC 0x474C5243u  // 'C','R','L','G' log record
+
+#define CREDS_SECTORS (CREDS_FLASH_SIZE / FLASH_SECTOR_SIZE)
+
+static_assert(CREDS_FLASH_SIZE % FLASH_SECTOR_SIZE == 0, "creds region must be whole sectors");
+static_assert(CREDS_SECTORS >= 2, "the log needs at least two sectors");
+
+// Record kinds (RecordHeader.flags)
+#define REC_STRUCT    0x0000    // whole DeviceCreds image, first log format (read only)
+#define REC_DELTA     0x0001    // TLV entries applied on top of the previous state
+#define REC_SNAPSHOT  0x0002    // TLV entries forming the complete state
+
+// The region is an append-only log of page-aligned records. A sector is
+// only erased when the log wraps into it, and the first record written to a
+// sector is always a snapshot, so everything live sits in the newest
+// snapshot's sector. Torn writes fail the CRC and are skipped.
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t seq;       // monotonically increasing, newest valid record wins
+    uint16_t len;       // payload bytes following the header
+    uint16_t flags;     // REC_*
+    uint32_t crc;       // covers seq, len, flags and payload
+};
+
+struct TlvHeader {
+    uint16_t key;
+    uint8_t type;
+    uint8_t len;
+};
+
+static_assert(sizeof(TlvHeader) == 4, "TLV header is stored as-is");
+
+static constexpr uint32_t record_span(uint32_t len) {
+    return (sizeof(RecordHeader) + len + FLASH_PAGE_SIZE - 1) & ~(uint32_t)(FLASH_PAGE_SIZE - 1);
+}
+
+// largest state a snapshot can hold
+#define KV_MAX_STATE_BYTES (FLASH_SECTOR_SIZE - sizeof(RecordHeader))
+
+struct IndexEntry {
+    uint16_t key;
+    uint8_t type;
+    uint8_t len;
+    uint32_t off;       // region offset of the value bytes
+};
+
+static IndexEntry kv_index[KV_MAX_KEYS];   // sorted by key
+static size_t kv_index_count;
+static uint32_t live_bytes;                // TLV bytes a snapshot of the index needs
+
+static struct {
+    bool mounted;
+    bool has_record;
+    bool has_snapshot;
+    bool has_legacy;
+    uint32_t newest_off;    // newest valid record of any kind
+    uint32_t snapshot_off;  // newest snapshot
+    uint32_t legacy_off;    // newest REC_STRUCT record
+    uint32_t write_off;     // where the next record is attempted
+    uint32_t next_seq;
+} log_state;
+
+static uint8_t page_buf[FLASH_PAGE_SIZE];
+
+// ------------------- Flash access -------------------
+
+static uint32_t sector_start(uint32_t off) {
+    return off - (off % FLASH_SECTOR_SIZE);
+}
+
+static bool is_erased(uint32_t off, uint32_t len) {
+    const uint32_t *w = (const uint32_t*)flash_hal_ptr(off);
+    for (uint32_t i = 0; i < len / 4; i++) {
+        if (w[i] != 0xFFFFFFFFu) return false;
+    }
+    return true;
+}
+
+// ------------------- Records -------------------
+
+static uint32_t record_crc(const RecordHeader *h, const void *payload) {
+    uint32_t c = crc32_update(0, &h->seq, offsetof(RecordHeader, crc) - offsetof(RecordHeader, seq));
+    return crc32_update(c, payload, h->len);
+}
+
+static const RecordHeader *record_at(uint32_t off) {
+    const RecordHeader *h = (const RecordHeader*)flash_hal_ptr(off);
+    if (h->magic != CREDS_LOG_MAGIC) return nullptr;
+    if (sector_start(off) + FLASH_SECTOR_SIZE < off + record_span(h->len)) return nullptr;
+    if (record_crc(h, h + 1) != h->crc) return nullptr;
+    return h;
+}
+
+// ------------------- Index -------------------
+
+static size_t index_lower_bound(uint16_t key) {
+    size_t lo = 0, hi = kv_index_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (kv_index[mid].key < key) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static const IndexEntry *index_find(uint16_t key) {
+    size_t i = index_lower_bound(key);
+    return (i < kv_index_count && kv_index[i].key == key) ? &kv_index[i] : nullptr;
+}
+
+static void index_remove(uint16_t key) {
+    size_t i = index_lower_bound(key);
+    if (i == kv_index_count || kv_index[i].key != key) return;
+    live_bytes -= sizeof(TlvHeader) + kv_index[i].len;
+    memmove(&kv_index[i], &kv_index[i + 1], (kv_index_count - i - 1) * sizeof(IndexEntry));
+    kv_index_count--;
+}
+
+static void index_put(uint16_t key, uint8_t type, uint8_t len, uint32_t off) {
+    size_t i = index_lower_bound(key);
+    if (i < kv_index_count && kv_index[i].key == key) {
+        live_bytes -= kv_index[i].len;
+    } else {
+        if (kv_index_count == KV_MAX_KEYS) return;   // writer never lets this happen
+        memmove(&kv_index[i + 1], &kv_index[i], (kv_index_count - i) * sizeof(IndexEntry));
+        kv_index_count++;
+        live_bytes += sizeof(TlvHeader);
+    }
+    kv_index[i] = IndexEntry{key, type, len, off};
+    live_bytes += len;
+}
+
+static void apply_record(uint32_t off, const RecordHeader *h) {
+    if (h->flags == REC_SNAPSHOT) {
+        kv_index_count = 0;
+        live_bytes = 0;
+    }
+    uint32_t pos = off + sizeof(RecordHeader);
+    uint32_t end = pos + h->len;
+    while (pos + sizeof(TlvHeader) <= end) {
+        TlvHeader t;
+        memcpy(&t, flash_hal_ptr(pos), sizeof(t));
+        pos += sizeof(t);
+        if (pos + t.len > end) break;
+        if (t.type == KV_TYPE_DELETED) index_remove(t.key);
+        else index_put(t.key, t.type, t.len, pos);
+        pos += t.len;
+    }
+}
+
+// Replay the newest snapshot and the deltas after it. Entering a sector always
+// writes a snapshot, so those deltas all live in the same sector.
+static void replay_from(uint32_t start) {
+    uint32_t end = sector_start(start) + FLASH_SECTOR_SIZE;
+    uint32_t last_seq = 0;
+    for (uint32_t off = start; off < end; ) {
+        const RecordHeader *h = record_at(off);
+        if (!h) { off += FLASH_PAGE_SIZE; continue; }
+        if (h->flags != REC_STRUCT && (off == start || h->seq > last_seq)) {
+            apply_record(off, h);
+            last_seq = h->seq;
+        }
+        off += record_span(h->len);
+    }
+}
+
+// Scan the region once and rebuild the index
+static void kv_mount() {
+    if (log_state.mounted) return;
+    memset(&log_state, 0, sizeof(log_state));
+    log_state.mounted = true;
+    log_state.next_seq = 1;
+    // an empty log starts in the second sector so a legacy Blob survives the first save
+    log_state.write_off = FLASH_SECTOR_SIZE;
+    kv_index_count = 0;
+    live_bytes = 0;
+
+    uint32_t snapshot_seq = 0, legacy_seq = 0;
+    uint32_t off = 0;
+    while (off < CREDS_FLASH_SIZE) {
+        const RecordHeader *h = record_at(off);
+        if (!h) { off += FLASH_PAGE_SIZE; continue; }
+        if (!log_state.has_record || h->seq >= log_state.next_seq) {
+            log_state.has_record = true;
+            log_state.newest_off = off;
+            log_state.next_seq = h->seq + 1;
+            log_state.write_off = off + record_span(h->len);
+        }
+        if (h->flags == REC_SNAPSHOT && (!log_state.has_snapshot || h->seq > snapshot_seq)) {
+            log_state.has_snapshot = true;
+            log_state.snapshot_off = off;
+            snapshot_seq = h->seq;
+        }
+        if (h->flags == REC_STRUCT && (!log_state.has_legacy || h->seq > legacy_seq)) {
+            log_state.has_legacy = true;
+            log_state.legacy_off = off;
+            legacy_seq = h->seq;
+        }
+        off += record_span(h->len);
+    }
+
+    if (log_state.has_snapshot) replay_from(log_state.snapshot_off);
+}
+
+// ------------------- Writer -------------------
+
+// Serializes a record twice: once into the CRC, once into page programs
+struct Emitter {
+    bool program;
+    bool ok;
+    uint32_t crc;
+    uint32_t off;       // next page to program
+    uint32_t fill;
+};
+
+static void emit_flush(Emitter &e) {
+    if (!e.fill) return;
+    memset(page_buf + e.fill, 0xFF, FLASH_PAGE_SIZE - e.fill);
+    if (e.ok && !flash_hal_program(e.off, page_buf, FLASH_PAGE_SIZE)) e.ok = false;
+    e.off += FLASH_PAGE_SIZE;
+    e.fill = 0;
+}
+
+static void emit(Emitter &e, const void *data, size_t n) {
+    if (!e.program) {
+        e.crc = crc32_update(e.crc, data, n);
+        return;
+    }
+    const uint8_t *p = (const uint8_t*)data;
+    while (n) {
+        size_t k = FLASH_PAGE_SIZE - e.fill;
+        if (k > n) k = n;
+        memcpy(page_buf + e.fill, p, k);
+        e.fill += k; p += k; n -= k;
+        if (e.fill == FLASH_PAGE_SIZE) emit_flush(e);
+    }
+}
+
+static void emit_tlv(Emitter &e, uint16_t key, uint8_t type, uint8_t len, const void *value) {
+    TlvHeader t{key, type, len};
+    emit(e, &t, sizeof(t));
+    if (len) emit(e, value, len);
+}
+
+static const KvWrite *find_change(const KvWrite *w, size_t n, uint16_t key) {
+    for (size_t i = 0; i < n; i++) {
+        if (w[i].key == key) return &w[i];
+    }
+    return nullptr;
+}
+
+static void emit_payload(Emitter &e, const KvWrite *w, size_t n, bool snapshot) {
+    if (!snapshot) {
+        for (size_t i = 0; i < n; i++) emit_tlv(e, w[i].key, w[i].type, w[i].len, w[i].value);
+        return;
+    }
+    for (size_t i = 0; i < kv_index_count; i++) {
+        const IndexEntry &ie = kv_index[i];
+        const KvWrite *c = find_change(w, n, ie.key);
+        if (!c) emit_tlv(e, ie.key, ie.type, ie.len, flash_hal_ptr(ie.off));
+        else if (c->type != KV_TYPE_DELETED) emit_tlv(e, c->key, c->type, c->len, c->value);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (w[i].type != KV_TYPE_DELETED && !index_find(w[i].key))
+            emit_tlv(e, w[i].key, w[i].type, w[i].len, w[i].value);
+    }
+}
+
+static bool program_record(uint32_t off, uint16_t flags, uint32_t len, const KvWrite *w, size_t n) {
+    RecordHeader h{};
+    h.magic = CREDS_LOG_MAGIC;
+    h.seq = log_state.next_seq;
+    h.len = (uint16_t)len;
+    h.flags = flags;
+
+    Emitter c{};
+    c.crc = crc32_update(0, &h.seq, offsetof(RecordHeader, crc) - offsetof(RecordHeader, seq));
+    emit_payload(c, w, n, flags == REC_SNAPSHOT);
+    h.crc = c.crc;
+
+    Emitter p{};
+    p.program = true;
+    p.ok = true;
+    p.off = off;
+    emit(p, &h, sizeof(h));
+    emit_payload(p, w, n, flags == REC_SNAPSHOT);
+    emit_flush(p);
+    return p.ok;
+}
+
+// Append the (already filtered) changes as a delta, or as a snapshot when
+// entering a sector or when no snapshot exists yet
+static bool log_append(const KvWrite *w, size_t n, uint32_t delta_len, uint32_t snapshot_len) {
+    uint32_t off = log_state.write_off;
+    bool snapshot = !log_state.has_snapshot;
+    int sectors_left = CREDS_SECTORS;
+    while (true) {
+        off %= CREDS_FLASH_SIZE;
+        uint32_t len = snapshot ? snapshot_len : delta_len;
+        uint32_t span = record_span(len);
+        if (off % FLASH_SECTOR_SIZE + span > FLASH_SECTOR_SIZE) {
+            off = (sector_start(off) + FLASH_SECTOR_SIZE) % CREDS_FLASH_SIZE;
+        }
+        if (off % FLASH_SECTOR_SIZE == 0) {
+            if (!snapshot) { snapshot = true; continue; }
+            // entering a sector: it only holds superseded records, so recycle it
+            if (--sectors_left < 0) return false;
+            if (log_state.has_record && sector_start(log_state.newest_off) == off) return false;
+            if (log_state.has_snapshot && sector_start(log_state.snapshot_off) == off) return false;
+            if (!is_erased(off, FLASH_SECTOR_SIZE) && !flash_hal_erase(off)) return false;
+        }
+        if (!is_erased(off, span)) {
+            // torn or foreign data; never program over it
+            off += FLASH_PAGE_SIZE;
+            continue;
+        }
+        if (!program_record(off, snapshot ? REC_SNAPSHOT : REC_DELTA, len, w, n)) return false;
+        const RecordHeader *h = record_at(off);
+        if (h) {
+            apply_record(off, h);
+            log_state.has_record = true;
+            log_state.newest_off = off;
+            if (snapshot) {
+                log_state.has_snapshot = true;
+                log_state.snapshot_off = off;
+            }
+            log_state.next_seq++;
+            log_state.write_off = off + span;
+            return true;
+        }
+        off += span;    // failed verify, leave it behind
+    }
+}
+
+// ------------------- Public API -------------------
+
+static bool same_as_stored(const KvWrite &w) {
+    const IndexEntry *e = index_find(w.key);
+    if (w.type == KV_TYPE_DELETED) return e == nullptr;
+    return e && e->type == w.type && e->len == w.len &&
+           (w.len == 0 || memcmp(flash_hal_ptr(e->off), w.value, w.len) == 0);
+}
+
+bool kv_set_many(const KvWrite *w, size_t n) {
+    kv_mount();
+    if (n > KV_MAX_KEYS) return false;
+
+    KvWrite changed[KV_MAX_KEYS];
+    size_t m = 0;
+    uint32_t delta_len = 0, state_len = live_bytes;
+    size_t keys = kv_index_count;
+    for (size_t i = 0; i < n; i++) {
+        if (w[i].len && !w[i].value) return false;
+        // a key given twice is written once, with its last value
+        bool superseded = false;
+        for (size_t j = i + 1; j < n && !superseded; j++) superseded = w[j].key == w[i].key;
+        if (superseded || same_as_stored(w[i])) continue;
+        const IndexEntry *e = index_find(w[i].key);
+        if (e) { state_len -= sizeof(TlvHeader) + e->len; keys--; }
+        if (w[i].type != KV_TYPE_DELETED) { state_len += sizeof(TlvHeader) + w[i].len; keys++; }
+        delta_len += sizeof(TlvHeader) + w[i].len;
+        changed[m++] = w[i];
+    }
+    if (m == 0) return true;
+    if (keys > KV_MAX_KEYS || state_len > KV_MAX_STATE_BYTES) return false;
+
+    return log_append(changed, m, delta_len, state_len);
+}
+
+bool kv_set(uint16_t key, KvType type, const void *value, size_t len) {
+    if (len > KV_MAX_VALUE_LEN) return false;
+    KvWrite w{key, type, (uint8_t)len, value};
+    return kv_set_many(&w, 1);
+}
+
+bool kv_delete(uint16_t key) {
+    KvWrite w{key, KV_TYPE_DELETED, 0, nullptr};
+    return kv_set_many(&w, 1);
+}
+
+bool kv_get(uint16_t key, void *buf, size_t cap, size_t *len_out, KvType *type_out) {
+    kv_mount();
+    const IndexEntry *e = index_find(key);
+    if (!e || e->len > cap) return false;
+    memcpy(buf, flash_hal_ptr(e->off), e->len);
+    if (len_out) *len_out = e->len;
+    if (type_out) *type_out = (KvType)e->type;
+    return true;
+}
+
+bool kv_exists(uint16_t key) {
+    kv_mount();
+    return index_find(key) != nullptr;
+}
+
+bool kv_set_u32(uint16_t key, uint32_t v) {
+    return kv_set(key, KV_TYPE_U32, &v, sizeof(v));
+}
+
+bool kv_get_u32(uint16_t key, uint32_t &out) {
+    uint8_t raw[4] = {0};
+    size_t len;
+    KvType type;
+    if (!kv_get(key, raw, sizeof(raw), &len, &type)) return false;
+    if (type == KV_TYPE_U8) out = raw[0];
+    else if (type == KV_TYPE_U16) out = (uint32_t)raw[0] | (uint32_t)raw[1] << 8;
+    else if (type == KV_TYPE_U32) memcpy(&out, raw, sizeof(out));
+    else return false;
+    return true;
+}
+
+bool kv_set_str(uint16_t key, const char *s) {
+    return kv_set(key, KV_TYPE_STR, s, strlen(s));
+}
+
+bool kv_get_str(uint16_t key, char *buf, size_t cap) {
+    size_t len;
+    if (!cap || !kv_get(key, buf, cap - 1, &len)) return false;
+    buf[len] = '\0';
+    return true;
+}
+
+void kv_iter(kv_iter_cb cb, void *arg) {
+    kv_mount();
+    for (size_t i = 0; i < kv_index_count; i++) {
+        const IndexEntry &e = kv_index[i];
+        if (!cb(e.key, (KvType)e.type, flash_hal_ptr(e.off), e.len, arg)) break;
+    }
+}
+
+size_t kv_count() {
+    kv_mount();
+    return kv_index_count;
+}
+
+bool kv_legacy_image(size_t image_len, const void **data, size_t *len) {
+    kv_mount();
+    if (log_state.has_snapshot) return false;
+    if (log_state.has_legacy) {
+        const RecordHeader *h = record_at(log_state.legacy_off);
+        if (!h) return false;
+        *data = h + 1;
+        *len = h->len;
+        return true;
+    }
+    if (log_state.has_record) return false;
+
+    // original format: magic, crc, then the struct at the start of the region
+    const uint32_t *b = (const uint32_t*)flash_hal_ptr(0);
+    if (b[0] != CREDS_MAGIC) return false;
+    if (crc32(b + 2, image_len) != b[1]) return false;
+    *data = b + 2;
+    *len = image_len;
+    return true;
+}
+
+void kv_unmount() {
+    log_state.mounted = false;
+}
+
+void kv_format() {
+    for (uint32_t off = 0; off < CREDS_FLASH_SIZE; off += FLASH_SECTOR_SIZE) {
+        if (!is_erased(off, FLASH_SECTOR_SIZE)) flash_hal_erase(off);
+    }
+    log_state.mounted = false;
+}
@@ -1,5 +1,6 @@
 #include "pico/stdlib.h"
 #include "pico_captive_connect.h"
+#include "scheduler.h"
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
@@ -8,13 +9,34 @@
 
 
 
-static absolute_time_t next_pub = 0;
+static SchedTimer pub_timer;
 
 float random_temp(){
     uint32_t r = get_rand_32();
     return 20.0f + (r % 1000) / 100.0f;
 }
 
+// Runs from net_task(); re-arms itself for the next publish
+static void publish_temp(void *arg) {
+    (void)arg;
+    // Publish only if MQTT connected
+    if (!mqtt_is_connected()) {
+        sched_timer_start(pub_timer, 1000, 0, publish_temp, nullptr);
+        return;
+    }
+    float temp = random_temp();
+    char msg[64];
+    snprintf(msg, sizeof(msg), "{\"temp\":%.2f}", temp);
+
+    if (publish_mqtt("sensors/temp", msg, strlen(msg))) {
+        printf("[APP] Published temp message: %.2f\n", temp);
+        sched_timer_start(pub_timer, 1000, 0, publish_temp, nullptr); // normal period
+    } else {
+        printf("[APP] Publish failed, backing off\n");
+        sched_timer_start(pub_timer, 5000, 0, publish_temp, nullptr); // backoff if error
+    }
+}
+
 
 int main() {
     stdio_init_all();
@@ -31,31 +53,15 @@ int main() {
     net_init();
 
     watchdog_enable(30000, 1); 
+    sched_defer(pub_timer, publish_temp, nullptr);
 
     while (true) {
         watchdog_update();
-        net_task();
+        net_task();     // sleeps until the next timer or network event
 
         // If Wi-Fi is up but MQTT not yet, keep retrying
         if (net_is_connected() && !mqtt_is_connected()) {
             mqtt_try_connect();
         }
-
-        // Publish only if MQTT connected and it's time
-        if (mqtt_is_connected() && absolute_time_diff_us(get_absolute_time(), next_pub) < 0) {
-            float temp = random_temp();
-            char msg[64];
-            snprintf(msg, sizeof(msg), "{\"temp\":%.2f}", temp);
-
-            if (publish_mqtt("sensors/temp", msg, strlen(msg))) {
-                printf("[APP] Published temp message: %.2f\n", temp);
-                next_pub = make_timeout_time_ms(1000); // normal period
-            } else {
-                printf("[APP] Publish failed, backing off\n");
-                next_pub = make_timeout_time_ms(5000); // backoff if error
-            }
-        }
-
-        sleep_ms(100);
     }
-}
\ No newline at end of file
+}
@@ -4,14 +4,19 @@
 #include "dns_hijack.h"
 #include "dhcpserver.h"
 #include "sta_portal.h"
+#include "scheduler.h"
+#include "wifi_scan.h"
 
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
+#include "pico/async_context.h"
 #include "lwip/netif.h"
 #include "lwip/ip4_addr.h"
 #include "lwip/apps/mqtt.h"
 #include "lwip/dns.h"
 #include "lwip/timeouts.h"
+#include "lwip/dhcp.h"
+#include "lwip/prot/dhcp.h"
 // #include "lwip/tcp.h"
 #include <cstdio>
 #include <cstring>
@@ -21,12 +26,80 @@ static dhcp_server_t dhcp;
 static DeviceCreds creds;
 static bool connected = false;
 static mqtt_client_t* mqtt_client_handle = nullptr;
-static absolute_time_t mqtt_connect_next_attempt = 0;
 static bool in_ap_mode = false;
 static bool mqtt_inflight = false; 
-static absolute_time_t next_check = 0;
-static absolute_time_t next_sta_retry = 0;
 static int lost_counter = 0;
+static bool creds_reboot_pending = false;
+
+static SchedTimer link_check_timer;     // 5 s, STA link supervision
+static SchedTimer sta_retry_timer;      // 5 min, AP mode: retry STA with saved creds
+static SchedTimer mqtt_retry_timer;     // MQTT connect backoff
+static SchedTimer creds_check_work;     // react to a creds change outside creds_save()
+static SchedTimer reboot_timer;
+static SchedTimer sta_poll_timer;       // STA connect progress
+static NetStaState sta_state = NET_STA_IDLE;
+static absolute_time_t sta_deadline;    // end of the current connect phase
+static SchedTimer *sta_watch;           // deferred on STA state changes
+static sched_fn sta_watch_fn;
+static void *sta_watch_arg;
+static WifiLinkCache link_cache;        // where the last connection to creds.ssid landed
+static bool fast_join;                  // directed join to link_cache in progress
+static bool lease_primed;               // DHCP set up to request link_cache.ip
+static absolute_time_t link_cache_at;   // when link_cache was written, or boot
+static uint16_t lease_used_seen;        // lwIP's lease_used at the last link_check()
+static absolute_time_t sta_started;
+static absolute_time_t sta_joined;
+static NetStaStats sta_stats;
+static SchedTimer *telemetry_watch;     // deferred on MQTT state changes
+static sched_fn telemetry_watch_fn;
+static void *telemetry_watch_arg;
+static NetTelemetry telemetry;
+static async_when_pending_worker_t wake_worker;
+
+#ifndef NET_TASK_MAX_SLEEP_MS
+// longest net_task() sleeps with nothing due, well inside the watchdog period
+#define NET_TASK_MAX_SLEEP_MS 1000
+#endif
+
+#ifndef NET_STA_JOIN_TIMEOUT_MS
+// association plus WPA handshake, including rejoins while the AP isn't seen
+#define NET_STA_JOIN_TIMEOUT_MS 12000
+#endif
+
+#ifndef NET_STA_DHCP_TIMEOUT_MS
+// linked, waiting for a lease
+#define NET_STA_DHCP_TIMEOUT_MS 8000
+#endif
+
+#ifndef NET_STA_FAST_JOIN_TIMEOUT_MS
+// directed join to the remembered AP before falling back to a full scan
+#define NET_STA_FAST_JOIN_TIMEOUT_MS 3000
+#endif
+
+#ifndef NET_STA_POLL_MS
+#define NET_STA_POLL_MS 100
+#endif
+
+#ifndef MQTT_RETRY_MS
+// backoff between broker connect attempts
+#define MQTT_RETRY_MS 5000
+#endif
+
+#ifndef MQTT_DNS_CACHE_TTL_S
+// lwIP honours the record TTL in its own table but doesn't report it, so our
+// copy is revalidated on this period; the old address stays in use meanwhile
+#define MQTT_DNS_CACHE_TTL_S 300
+#endif
+
+// Broker address cache, seeded from flash at boot
+struct BrokerAddr {
+    bool valid;
+    bool resolving;
+    ip_addr_t addr;
+    absolute_time_t expires;
+    char host[sizeof(DeviceCreds::mqtt_host)];
+};
+static BrokerAddr broker;
 
 
 // New state machine for MQTT
@@ -37,31 +110,208 @@ enum MqttState {
 };
 static MqttState mqtt_state = MQTT_DISCONNECTED;
 
+static void mqtt_set_state(MqttState s) {
+    if (s == mqtt_state) return;
+    if (s == MQTT_CONNECTED) telemetry.mqtt_connects++;
+    if (mqtt_state == MQTT_CONNECTED) telemetry.mqtt_drops++;
+    mqtt_state = s;
+    if (telemetry_watch) sched_defer(*telemetry_watch, telemetry_watch_fn, telemetry_watch_arg);
+}
+
 // ------------------- Wi-Fi Helpers -------------------
 
-static bool try_sta_connect(const DeviceCreds &c, char *ipbuf, size_t ipbuflen) {
-    printf("STA: connecting to '%s'...\n", c.ssid);
-    if (cyw43_arch_wifi_connect_timeout_ms(c.ssid, c.wifi_pass, CYW43_AUTH_WPA2_AES_PSK, 20000)) {
-        printf("STA: connect failed\n");
-        return false;
+static const char *sta_phase_name(NetStaState s) {
+    switch (s) {
+    case NET_STA_JOINING: return "joining";
+    case NET_STA_DHCP:    return "dhcp";
+    case NET_STA_UP:      return "up";
+    case NET_STA_FAILED:  return "failed";
+    default:              return "idle";
     }
-    auto *netif = netif_list;
-    if (netif && netif_is_up(netif)) {
-        snprintf(ipbuf, ipbuflen, "%s", ip4addr_ntoa(netif_ip4_addr(netif)));
-        printf("STA: connected, IP=%s\n", ipbuf);
-        return true;
+}
+
+static void sta_set_state(NetStaState s, uint32_t timeout_ms) {
+    if (s != sta_state) printf("STA: %s\n", sta_phase_name(s));
+    sta_state = s;
+    sta_deadline = make_timeout_time_ms(timeout_ms);
+    if (sta_watch) sched_defer(*sta_watch, sta_watch_fn, sta_watch_arg);
+}
+
+static uint32_t sta_auth() {
+    return creds.wifi_pass[0] ? CYW43_AUTH_WPA2_AES_PSK : CYW43_AUTH_OPEN;
+}
+
+// Association and WPA handshake run in the driver; returns a driver error.
+// The fast join goes straight to the remembered BSSID and channel, no scan.
+static int sta_join() {
+    if (!fast_join) return cyw43_arch_wifi_connect_async(creds.ssid, creds.wifi_pass, sta_auth());
+    return cyw43_wifi_join(&cyw43_state, strlen(creds.ssid), (const uint8_t*)creds.ssid,
+                           strlen(creds.wifi_pass), (const uint8_t*)creds.wifi_pass,
+                           link_cache.auth, link_cache.bssid, link_cache.channel);
+}
+
+// Start DHCP in INIT-REBOOT (RFC 2131 3.2): the first message on link-up is a
+// REQUEST for the remembered address instead of a DISCOVER. The server ACKs
+// or NAKs it; on a NAK or no answer lwIP falls back to DISCOVER by itself.
+// Only while the lease can still be running: there is no clock across power
+// cycles, so time spent off isn't counted and a NAK covers that case.
+static void sta_prime_lease() {
+    int64_t since_s = absolute_time_diff_us(link_cache_at, get_absolute_time()) / 1000000;
+    if (link_cache.ip == 0 || since_s >= (int64_t)link_cache.lease_left_s) {
+        lease_primed = false;
+        return;
     }
-    printf("STA: no IP (DHCP)\n");
-    return false;
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+    cyw43_arch_lwip_begin();
+    struct dhcp *d = netif_dhcp_data(n);
+    lease_primed = d && d->state != DHCP_STATE_BOUND;
+    if (lease_primed) {
+        ip4_addr_set_u32(&d->offered_ip_addr, link_cache.ip);
+        ip4_addr_set_u32(&d->offered_sn_mask, link_cache.netmask);
+        ip4_addr_set_u32(&d->offered_gw_addr, link_cache.gw);
+        d->state = DHCP_STATE_REBOOTING;
+        d->tries = 0;
+        ip_addr_t dns;
+        ip_addr_set_ip4_u32(&dns, link_cache.dns);
+        dns_setserver(0, &dns);
+    }
+    cyw43_arch_lwip_end();
+}
+
+// Called once the link is up and on each lease renewal
+static void sta_remember_link() {
+    WifiLinkCache lc{};
+    uint32_t chan[3];   // channel_info_t: hw, target, scan
+    if (cyw43_wifi_get_bssid(&cyw43_state, lc.bssid) != 0) return;
+    if (cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(chan), (uint8_t*)chan, CYW43_ITF_STA) != 0) return;
+    lc.channel = (uint8_t)chan[0];
+    lc.auth = sta_auth();
+    struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
+    cyw43_arch_lwip_begin();
+    lc.ip = ip4_addr_get_u32(netif_ip4_addr(n));
+    lc.netmask = ip4_addr_get_u32(netif_ip4_netmask(n));
+    lc.gw = ip4_addr_get_u32(netif_ip4_gw(n));
+    lc.dns = ip4_addr_get_u32(ip_2_ip4(dns_getserver(0)));
+    struct dhcp *d = netif_dhcp_data(n);
+    if (d && d->state == DHCP_STATE_BOUND && d->t0_timeout > d->lease_used) {
+        lc.lease_left_s = (uint32_t)(d->t0_timeout - d->lease_used) * DHCP_COARSE_TIMER_SECS;
+    }
+    lease_used_seen = d ? d->lease_used : 0;
+    cyw43_arch_lwip_end();
+    link_cache_at = get_absolute_time();
+    creds_set_link_cache(creds.ssid, lc);
 }
 
 static void net_stop_all() {
     printf("[NET] Stopping all network services...\n");
+    // listeners are bound to the old interface address
+    http_portal_stop();
+    sta_http_stop();
     dns_hijack_stop();
+    wifi_scan_stop();
     dhcp_server_deinit(&dhcp);
     cyw43_arch_disable_ap_mode();
     cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);    
     connected = false;
+    sched_timer_stop(sta_poll_timer);
+    sched_timer_stop(sta_retry_timer);
+    sched_timer_stop(mqtt_retry_timer);
+}
+
+// ------------------- Credential Checks -------------------
+
+bool creds_are_valid(const DeviceCreds &c) {
+    if (!c.valid) return false;
+    if (c.ssid[0] == '\0') return false;
+    return true;
+}
+
+bool mqtt_creds_are_valid(const DeviceCreds &c){
+    if (c.mqtt_host[0] == '\0') return false;
+    if (c.mqtt_port == 0) return false;
+    return true;
+}
+
+// ------------------- Scheduled work -------------------
+
+static void reboot_now(void *arg) {
+    (void)arg;
+    dns_hijack_stop();
+    dhcp_server_deinit(&dhcp);
+    cyw43_arch_deinit();
+    watchdog_reboot(0, 0, 0);
+}
+
+void net_schedule_reboot(uint32_t delay_ms) {
+    // the network keeps running meanwhile, so a last HTTP response still goes out
+    if (!sched_timer_armed(reboot_timer)) sched_timer_start(reboot_timer, delay_ms, 0, reboot_now, nullptr);
+}
+
+static void creds_check(void *arg) {
+    (void)arg;
+    if (!net_is_connected() && creds_reboot_pending) {
+        printf("New creds saved. Rebooting to connect...\n");
+        net_schedule_reboot(500);
+    }
+}
+
+// reboot if Wi-Fi disconnects unexpectedly
+static void link_check(void *arg) {
+    (void)arg;
+    creds_check(nullptr);
+    // sta_poll() watches the link until it is first up
+    if (in_ap_mode || sta_state != NET_STA_UP) return;
+
+    int status = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
+
+    // Only count as "lost" if fully disconnected or auth failed
+    bool truly_down = (
+        status == CYW43_LINK_DOWN ||
+        status == CYW43_LINK_BADAUTH ||
+        status == CYW43_LINK_NONET
+    );
+
+    if (truly_down) {
+        if (++lost_counter > 6) {   // e.g. 6×5 s = 30 s of real loss
+            printf("[NET] Wi-Fi link lost (status=%d, counter=%d). Rebooting...\n", status, lost_counter);
+            net_schedule_reboot(0);
+        }
+    } else {
+        lost_counter = 0;  // reset whenever link is OK
+        // lwIP restarts lease_used on every (re)bind: keep the time left current
+        cyw43_arch_lwip_begin();
+        struct dhcp *d = netif_dhcp_data(&cyw43_state.netif[CYW43_ITF_STA]);
+        bool renewed = d && d->state == DHCP_STATE_BOUND && d->lease_used < lease_used_seen;
+        if (d) lease_used_seen = d->lease_used;
+        cyw43_arch_lwip_end();
+        if (renewed) sta_remember_link();
+    }
+}
+
+static void start_sta_mode();
+
+// Periodically try to reconnect to stored STA credentials if in AP mode
+static void sta_retry(void *arg) {
+    (void)arg;
+    DeviceCreds stored{};
+    if (creds_load(stored) && creds_are_valid(stored)) {
+        printf("[NET] Saved Wi-Fi credentials found — retrying STA connection...\n");
+        creds = stored;
+        start_sta_mode();
+    } else {
+        printf("[NET] No valid credentials found — staying in AP mode.\n");
+    }
+}
+
+static void mqtt_retry(void *arg);
+
+// Runs in the async context; only there to end net_task()'s sleep
+static void wake_work(async_context_t *ctx, async_when_pending_worker_t *worker) {
+    (void)ctx; (void)worker;
+}
+
+static void net_wake() {
+    async_context_set_work_pending(cyw43_arch_async_context(), &wake_worker);
 }
 
 
@@ -81,47 +331,124 @@ static void start_ap_mode(){
     IP4_ADDR(&gw, 192,168,4,1);
     IP4_ADDR(&mask, 255,255,255,0);
     dhcp_server_init(&dhcp, &gw, &mask);
+#ifdef DHCPS_CAPTIVE_URI
+    // RFC 8910 clients only accept an https:// API URI, so it is opt-in
+    dhcp_server_set_captive_uri(&dhcp, DHCPS_CAPTIVE_URI);
+#endif
     dns_hijack_start(gw);
     http_portal_start();
+    wifi_scan_start();      // for the portal's network list
 
     printf("AP: connect to SSID '%s', password '%s' then open http://setup/\n", ap_ssid, ap_pass);
-    next_sta_retry = make_timeout_time_ms(300000); 
+    sched_timer_start(sta_retry_timer, 300000, 300000, sta_retry, nullptr);   // retry every 5 minutes
 
 }
 
-static void start_sta_mode(){
-    net_stop_all();
+static void sta_fail(const char *why) {
+    printf("STA: %s; entering provisioning.\n", why);
+    sta_set_state(NET_STA_FAILED, 0);
+    start_ap_mode();
+}
 
-    in_ap_mode = false;
-    cyw43_arch_enable_sta_mode();
-    char ip[32];
-    if (try_sta_connect(creds, ip, sizeof ip)) {
-        connected = true;
-        dns_hijack_stop();
-        dhcp_server_deinit(&dhcp);
-        cyw43_arch_disable_ap_mode();
+static uint32_t ms_between(absolute_time_t from, absolute_time_t to) {
+    return (uint32_t)(absolute_time_diff_us(from, to) / 1000);
+}
+
+static void sta_record_connect(uint32_t ip) {
+    absolute_time_t now = get_absolute_time();
+    bool reused = lease_primed && ip == link_cache.ip;
+    sta_stats.connects++;
+    if (fast_join) sta_stats.fast_joins++;
+    if (reused) sta_stats.leases_reused++;
+    sta_stats.last_join_ms = ms_between(sta_started, sta_joined);
+    sta_stats.last_dhcp_ms = ms_between(sta_joined, now);
+    if (!sta_stats.boot_to_ip_ms) sta_stats.boot_to_ip_ms = to_ms_since_boot(now);
+    printf("STA: up in %lu ms (join %lu ms%s, DHCP %lu ms%s)\n",
+           (unsigned long)ms_between(sta_started, now),
+           (unsigned long)sta_stats.last_join_ms, fast_join ? ", remembered AP" : "",
+           (unsigned long)sta_stats.last_dhcp_ms, reused ? ", lease reused" : "");
+}
 
-        printf("Web UI available at http://%s\n", ip);
+// Runs from net_task() every NET_STA_POLL_MS while connecting; each phase has
+// its own deadline so a dead AP and a dead DHCP server fail equally fast
+static void sta_poll(void *arg) {
+    (void)arg;
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    if (status == CYW43_LINK_UP) {
+        sched_timer_stop(sta_poll_timer);
+        connected = true;
+        if (sta_state == NET_STA_JOINING) sta_joined = get_absolute_time();
+        sta_set_state(NET_STA_UP, 0);
+        sta_record_connect(ip4_addr_get_u32(netif_ip4_addr(&cyw43_state.netif[CYW43_ITF_STA])));
+        sta_remember_link();
+        printf("STA: connected, IP=%s\n", ip4addr_ntoa(netif_ip4_addr(netif_list)));
+        printf("Web UI available at http://%s\n", ip4addr_ntoa(netif_ip4_addr(netif_list)));
         sta_http_start();
+        sched_defer(mqtt_retry_timer, mqtt_retry, nullptr);
         return;
     }
-    connected = false;
-    printf("STA failed; entering provisioning.\n");
-    start_ap_mode();
+    if (status == CYW43_LINK_BADAUTH) {
+        sta_fail("wrong password");
+        return;
+    }
+    if (fast_join && sta_state == NET_STA_JOINING &&
+        (status == CYW43_LINK_FAIL || status == CYW43_LINK_NONET || time_reached(sta_deadline))) {
+        // the AP moved or is gone: find it the slow way
+        printf("STA: remembered AP not found, scanning\n");
+        fast_join = false;
+        sta_stats.fast_join_misses++;
+        if (sta_join() != 0) {
+            sta_fail("connect failed");
+            return;
+        }
+        sta_set_state(NET_STA_JOINING, NET_STA_JOIN_TIMEOUT_MS);
+        return;
+    }
+    if (status == CYW43_LINK_FAIL) {
+        sta_fail("connect failed");
+        return;
+    }
+    if (status == CYW43_LINK_NOIP && sta_state == NET_STA_JOINING) {
+        sta_joined = get_absolute_time();
+        sta_set_state(NET_STA_DHCP, NET_STA_DHCP_TIMEOUT_MS);
+    }
+    if (time_reached(sta_deadline)) {
+        sta_fail(sta_state == NET_STA_DHCP ? "no IP (DHCP)" : "network not found");
+        return;
+    }
+    // AP not seen (yet): the driver gives up, so ask again until the deadline
+    if (status == CYW43_LINK_NONET && sta_join() != 0) sta_fail("connect failed");
 }
 
-// ------------------- Credential Checks -------------------
+// Returns at once; sta_poll() follows the connection from net_task()
+static void start_sta_mode(){
+    net_stop_all();
 
-bool creds_are_valid(const DeviceCreds &c) {
-    if (!c.valid) return false;
-    if (c.ssid[0] == '\0') return false;
-    return true;
+    in_ap_mode = false;
+    cyw43_arch_enable_sta_mode();
+    bool link_cached = creds_link_cache(creds.ssid, link_cache);
+    fast_join = link_cached && link_cache.channel && link_cache.auth == sta_auth();
+    lease_primed = false;
+    if (link_cached) sta_prime_lease();
+    printf("STA: connecting to '%s'%s...\n", creds.ssid, fast_join ? " (remembered AP)" : "");
+    sta_started = get_absolute_time();
+    sta_joined = sta_started;
+    if (sta_join() != 0) {
+        sta_fail("connect failed");
+        return;
+    }
+    sta_set_state(NET_STA_JOINING, fast_join ? NET_STA_FAST_JOIN_TIMEOUT_MS : NET_STA_JOIN_TIMEOUT_MS);
+    sched_timer_start(sta_poll_timer, NET_STA_POLL_MS, NET_STA_POLL_MS, sta_poll, nullptr);
 }
 
-bool mqtt_creds_are_valid(const DeviceCreds &c){
-    if (c.mqtt_host[0] == '\0') return false;
-    if (c.mqtt_port == 0) return false;
-    return true;
+// Runs from creds_save(); only records the change, net_task() acts on it
+static void on_creds_changed(const DeviceCreds &c, uint32_t generation, void *arg) {
+    (void)generation; (void)arg;
+    creds = c;
+    if (c.dirty) {
+        creds_reboot_pending = true;
+        sched_defer(creds_check_work, creds_check, nullptr);
+    }
 }
 
 // ------------------- Public API -------------------
@@ -132,7 +459,14 @@ void net_init() {
         printf("CYW43 init failed\n");
         return;
     }
-    if (creds_load(creds) && creds_are_valid(creds)) {
+    wake_worker.do_work = wake_work;
+    async_context_add_when_pending_worker(cyw43_arch_async_context(), &wake_worker);
+    sched_set_wake(net_wake);
+    sched_timer_start(link_check_timer, 5000, 5000, link_check, nullptr);
+
+    bool have_creds = creds_load(creds) && creds_are_valid(creds);
+    creds_subscribe(on_creds_changed, nullptr);
+    if (have_creds) {
         start_sta_mode();
     } else {
         start_ap_mode();
@@ -140,71 +474,15 @@ void net_init() {
 }
 
 void net_task() {
-    if (!net_is_connected()) {
-        DeviceCreds nc{};
-        // if (creds_load(nc) && memcmp(&nc, &creds, sizeof(DeviceCreds)) != 0) {
-        if (creds_load(nc) && nc.dirty) {
-            printf("New creds saved. Rebooting to connect...\n");
-            creds=nc;
-            sleep_ms(500);
-            dns_hijack_stop();
-            dhcp_server_deinit(&dhcp);
-            cyw43_arch_deinit();
-            watchdog_reboot(0, 0, 0);
-        }
-    }
-
+    // commit credential writes queued by the portals, outside lwIP callbacks
+    creds_service();
     sys_check_timeouts();
-    tight_loop_contents();
-
-    // reboot if Wi-Fi disconnects unexpectedly
-    if (absolute_time_diff_us(get_absolute_time(), next_check) < 0) {
-        next_check = make_timeout_time_ms(5000);
-
-        if (!in_ap_mode) {
-            int status = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
-
-            // Only count as "lost" if fully disconnected or auth failed
-            bool truly_down = (
-                status == CYW43_LINK_DOWN ||
-                status == CYW43_LINK_BADAUTH ||
-                status == CYW43_LINK_NONET
-            );
-
-            if (truly_down) {
-                if (++lost_counter > 6) {   // e.g. 6×5 s = 30 s of real loss
-                    printf("[NET] Wi-Fi link lost (status=%d, counter=%d). Rebooting...\n", status, lost_counter);
-                    dns_hijack_stop();
-                    dhcp_server_deinit(&dhcp);
-                    cyw43_arch_deinit();
-                    watchdog_reboot(0, 0, 0);
-                }
-            } else {
-                lost_counter = 0;  // reset whenever link is OK
-            }
-        }
-    }
-
-    // Periodically try to reconnect to stored STA credentials if in AP mode
-
-    if (in_ap_mode && absolute_time_diff_us(get_absolute_time(), next_sta_retry) < 0) {
-    next_sta_retry = make_timeout_time_ms(300000); // retry every 5 minutes
-
-    DeviceCreds stored{};
-    if (creds_load(stored) && creds_are_valid(stored)) {
-        printf("[NET] Saved Wi-Fi credentials found — rebooting to retry STA connection...\n");
-
-        // Gracefully stop network services before reboot
-        dns_hijack_stop();
-        dhcp_server_deinit(&dhcp);
-        cyw43_arch_deinit();
 
-        sleep_ms(100);
-        watchdog_reboot(0, 0, 0);
-    } else {
-        printf("[NET] No valid credentials found — staying in AP mode.\n");
-    }
-}
+    uint32_t wait_ms = sched_run();
+    if (creds_save_pending()) return;
+    if (wait_ms > NET_TASK_MAX_SLEEP_MS) wait_ms = NET_TASK_MAX_SLEEP_MS;
+    // woken early by sched_wake() when a callback arms a timer
+    if (wait_ms) cyw43_arch_wait_for_work_until(make_timeout_time_ms(wait_ms));
 
     // if (in_ap_mode) {
     //     if (absolute_time_diff_us(get_absolute_time(), next_sta_retry) < 0) {
@@ -277,13 +555,26 @@ static void mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection
     if (status == MQTT_CONNECT_ACCEPTED){
         printf("[MQTT] Connected!\n");
         mqtt_inflight = false; 
-        mqtt_state = MQTT_CONNECTED;
+        mqtt_set_state(MQTT_CONNECTED);
+        // remember it so the next boot can connect before DNS answers
+        creds_set_broker_addr(broker.host, ip4_addr_get_u32(ip_2_ip4(&broker.addr)));
 
     } else {
         printf("[MQTT] Connection failed, status=%d!\n", status);
-        mqtt_state = MQTT_DISCONNECTED;
-        mqtt_client_handle = nullptr;
+        // the address may have moved: look it up again on the next attempt
+        broker.expires = get_absolute_time();
+        bool was_up = mqtt_state == MQTT_CONNECTED;
+        mqtt_set_state(MQTT_DISCONNECTED);
+        // lwIP still touches the client after this returns; mqtt_connect()
+        // frees it before allocating the next one
         mqtt_inflight = false; 
+        if (was_up) {
+            // a session that was up gets one immediate retry
+            sched_defer(mqtt_retry_timer, mqtt_retry, nullptr);
+        } else if (!sched_timer_armed(mqtt_retry_timer)) {
+            // a refused or timed-out attempt keeps the backoff
+            sched_timer_start(mqtt_retry_timer, MQTT_RETRY_MS, 0, mqtt_retry, nullptr);
+        }
     }
 }
 
@@ -291,9 +582,69 @@ static void mqtt_pub_cb(void *arg, err_t result) {
     mqtt_inflight = false; 
     if (result == ERR_OK) {
         // printf("[MQTT] Publish confirmed\n");
+        telemetry.pub_ok++;
     } else {
         printf("[MQTT] Publish failed with err=%d\n", result);
+        telemetry.pub_failed++;
+    }
+}
+
+static void broker_set(const char *host, const ip_addr_t *ip, uint32_t ttl_ms) {
+    if (!broker.valid || ip4_addr_get_u32(ip_2_ip4(&broker.addr)) != ip4_addr_get_u32(ip_2_ip4(ip))) {
+        printf("[MQTT] %s is %s\n", host, ipaddr_ntoa(ip));
+    }
+    broker.valid = true;
+    broker.addr = *ip;
+    broker.expires = make_timeout_time_ms(ttl_ms);
+    snprintf(broker.host, sizeof broker.host, "%s", host);
+}
+
+static void broker_dns_found(const char *name, const ip_addr_t *ipaddr, void *arg) {
+    (void)arg;
+    broker.resolving = false;
+    if (strcmp(name, creds.mqtt_host) != 0) return;    // host changed meanwhile
+    if (!ipaddr) {
+        // keep using a stale address if we have one
+        printf("[MQTT] DNS lookup failed for %s\n", name);
+        return;
     }
+    broker_set(name, ipaddr, MQTT_DNS_CACHE_TTL_S * 1000);
+    // connect now instead of after the retry backoff
+    if (mqtt_state == MQTT_DISCONNECTED) sched_defer(mqtt_retry_timer, mqtt_retry, nullptr);
+}
+
+// Start a lookup unless one is already running
+static void broker_resolve() {
+    if (broker.resolving) return;
+    ip_addr_t ip;
+    err_t err = dns_gethostbyname(creds.mqtt_host, &ip, broker_dns_found, nullptr);
+    if (err == ERR_OK) {
+        broker_set(creds.mqtt_host, &ip, MQTT_DNS_CACHE_TTL_S * 1000);
+    } else if (err == ERR_INPROGRESS) {
+        printf("[MQTT] Resolving %s...\n", creds.mqtt_host);
+        broker.resolving = true;
+    } else {
+        printf("[MQTT] DNS lookup failed for %s\n", creds.mqtt_host);
+    }
+}
+
+// Address to connect to now, or nullptr while waiting for DNS. A stale entry
+// is still returned and refreshed in the background.
+static const ip_addr_t *broker_addr() {
+    if (broker.valid && strcmp(broker.host, creds.mqtt_host) != 0) broker.valid = false;
+    if (!broker.valid) {
+        uint32_t saved;
+        if (creds_broker_addr(creds.mqtt_host, saved)) {
+            ip_addr_t ip;
+            ip_addr_set_ip4_u32(&ip, saved);
+            printf("[MQTT] Using saved address for %s\n", creds.mqtt_host);
+            broker_set(creds.mqtt_host, &ip, 0);
+        }
+    }
+    if (!broker.valid || absolute_time_diff_us(get_absolute_time(), broker.expires) < 0) {
+        broker_resolve();
+    }
+    return broker.valid ? &broker.addr : nullptr;
 }
 
 bool mqtt_connect(){
@@ -317,14 +668,9 @@ bool mqtt_connect(){
         mqtt_client_handle = nullptr;
     }
 
-    ip_addr_t broker_ip;
-    err_t err = dns_gethostbyname(creds.mqtt_host, &broker_ip, NULL, NULL);
-    if(err == ERR_INPROGRESS){
-        printf("[MQTT] Resolving hostname ...\n");
-        return false;
-    } else if (err != ERR_OK) {
-        printf("[MQTT] DNS lookup failed for %s\n", creds.mqtt_host);
-        return false;
+    const ip_addr_t *broker_ip = broker_addr();
+    if (!broker_ip) {
+        return false;   // broker_dns_found() brings the next attempt forward
     }
 
     mqtt_client_handle = mqtt_client_new();
@@ -339,33 +685,37 @@ bool mqtt_connect(){
     ci.client_pass = creds.mqtt_pass[0] ? creds.mqtt_pass : NULL;
     ci.keep_alive = 60;
 
-    err = mqtt_client_connect(mqtt_client_handle, &broker_ip,
+    err_t err = mqtt_client_connect(mqtt_client_handle, broker_ip,
                               creds.mqtt_port ? creds.mqtt_port : 1883,
                               mqtt_connection_cb, NULL, &ci);
     if (err != ERR_OK){
         printf("[MQTT] Connect failed err=%d\n", err);
         mqtt_client_free(mqtt_client_handle);
         mqtt_client_handle = nullptr;
-        mqtt_state = MQTT_DISCONNECTED;
+        mqtt_set_state(MQTT_DISCONNECTED);
         return false;
     }
 
     printf("[MQTT] Connecting to %s:%d...\n", creds.mqtt_host, creds.mqtt_port);
-    mqtt_state = MQTT_CONNECTING;
+    mqtt_set_state(MQTT_CONNECTING);
     return false;
 }
 
-void mqtt_try_connect() {
-    if (absolute_time_diff_us(get_absolute_time(), mqtt_connect_next_attempt) > 0) {
-        return;
-    }
-    if (mqtt_state == MQTT_DISCONNECTED) {
-        if (!mqtt_connect()) {
-            mqtt_connect_next_attempt = make_timeout_time_ms(5000);
-        }
+// Retries every MQTT_RETRY_MS from net_task() while Wi-Fi is up and MQTT is down
+static void mqtt_retry(void *arg) {
+    (void)arg;
+    if (!net_is_connected() || mqtt_state != MQTT_DISCONNECTED) return;
+    if (!mqtt_connect()) {
+        sched_timer_start(mqtt_retry_timer, MQTT_RETRY_MS, 0, mqtt_retry, nullptr);
     }
 }
 
+void mqtt_try_connect() {
+    // a pending retry already has the backoff in hand
+    if (sched_timer_armed(mqtt_retry_timer)) return;
+    mqtt_retry(nullptr);
+}
+
 bool mqtt_is_connected() {
     return (mqtt_state == MQTT_CONNECTED);
 }
@@ -386,16 +736,21 @@ bool mqtt_is_connected() {
 
 bool publish_mqtt(const char* topic, const char* payload, size_t len) {
     if (!mqtt_is_connected()) return false;
-    if (mqtt_inflight) return false;
+    if (mqtt_inflight) {
+        telemetry.pub_busy++;
+        return false;
+    }
 
     err_t err = mqtt_publish(mqtt_client_handle, topic, payload, len, 0, 0, mqtt_pub_cb, NULL);
     if (err == ERR_MEM) {
         // lwIP queue full, don't panic, just retry later
         printf("[MQTT] ERR_MEM (queue full), will retry\n");
+        telemetry.pub_err_mem++;
         return false;
     }
     if (err != ERR_OK) {
         printf("[MQTT] publish failed, err=%d\n", err);
+        telemetry.pub_failed++;
         return false;
     }
 
@@ -403,6 +758,47 @@ bool publish_mqtt(const char* topic, const char* payload, size_t len) {
     return true;
 }
 
+const char *mqtt_state_name() {
+    switch (mqtt_state) {
+    case MQTT_CONNECTED:  return "connected";
+    case MQTT_CONNECTING: return "connecting";
+    default:              return "disconnected";
+    }
+}
+
+// ------------------- Telemetry -------------------
+
+const NetTelemetry &net_telemetry() {
+    return telemetry;
+}
+
+void net_telemetry_sample() {
+    int32_t rssi;
+    // a driver ioctl: only from net_task(), never from lwIP callbacks
+    if (net_is_connected() && cyw43_wifi_get_rssi(&cyw43_state, &rssi) == 0) telemetry.rssi = rssi;
+    else telemetry.rssi = 0;
+}
+
+NetStaState net_sta_state() {
+    return sta_state;
+}
+
+const NetStaStats &net_sta_stats() {
+    return sta_stats;
+}
+
+void net_sta_watch(SchedTimer *t, sched_fn fn, void *arg) {
+    sta_watch_fn = fn;
+    sta_watch_arg = arg;
+    sta_watch = t;
+}
+
+void net_telemetry_watch(SchedTimer *t, sched_fn fn, void *arg) {
+    telemetry_watch_fn = fn;
+    telemetry_watch_arg = arg;
+    telemetry_watch = t;
+}
+
 const char* net_hostname() {
     return creds.hostname[0] ? creds.hostname : "pico-device";
 }
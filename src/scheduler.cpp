@@ -0,0 +1,144 @@
+#include "scheduler.h"
+#include "pico/time.h"
+#include "pico/critical_section.h"
+#include <stddef.h>
+
+static_assert((SCHED_WHEEL_SLOTS & (SCHED_WHEEL_SLOTS - 1)) == 0, "SCHED_WHEEL_SLOTS must be a power of two");
+static_assert((SCHED_TICK_MS & (SCHED_TICK_MS - 1)) == 0, "SCHED_TICK_MS must be a power of two");
+
+static SchedTimer *wheel[SCHED_WHEEL_SLOTS];
+static SchedTimer *ready;           // expired, about to run
+static uint32_t cursor_ms;          // tick sched_run() last looked at
+static critical_section_t lock;     // timers are armed from lwIP callbacks too
+static bool lock_ready;
+static void (*wake_fn)(void);
+static SchedStats stats;
+
+static void lock_init() {
+    // first call comes from net_init() before any lwIP callback can arm a timer
+    if (!lock_ready) {
+        critical_section_init(&lock);
+        lock_ready = true;
+    }
+}
+
+static uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+// Wrap-safe: deadlines are always less than 2^31 ms away
+static bool is_due(uint32_t at, uint32_t now) {
+    return (int32_t)(at - now) <= 0;
+}
+
+static SchedTimer **slot_for(uint32_t at) {
+    return &wheel[(at / SCHED_TICK_MS) & (SCHED_WHEEL_SLOTS - 1)];
+}
+
+static void unlink(SchedTimer &t) {
+    if (!t.pprev) return;
+    *t.pprev = t.next;
+    if (t.next) t.next->pprev = t.pprev;
+    t.next = nullptr;
+    t.pprev = nullptr;
+}
+
+static void link(SchedTimer **head, SchedTimer &t) {
+    t.next = *head;
+    if (t.next) t.next->pprev = &t.next;
+    *head = &t;
+    t.pprev = head;
+}
+
+void sched_timer_start(SchedTimer &t, uint32_t delay_ms, uint32_t period_ms, sched_fn fn, void *arg) {
+    lock_init();
+    critical_section_enter_blocking(&lock);
+    unlink(t);
+    t.due_ms = now_ms() + delay_ms;
+    t.period_ms = period_ms;
+    t.fn = fn;
+    t.arg = arg;
+    link(slot_for(t.due_ms), t);
+    critical_section_exit(&lock);
+    sched_wake();
+}
+
+void sched_defer(SchedTimer &t, sched_fn fn, void *arg) {
+    sched_timer_start(t, 0, 0, fn, arg);
+}
+
+void sched_timer_stop(SchedTimer &t) {
+    lock_init();
+    critical_section_enter_blocking(&lock);
+    unlink(t);
+    critical_section_exit(&lock);
+}
+
+bool sched_timer_armed(const SchedTimer &t) {
+    return t.pprev != nullptr;
+}
+
+uint32_t sched_run() {
+    lock_init();
+    uint32_t now = now_ms();
+    critical_section_enter_blocking(&lock);
+
+    // only the slots of the ticks passed since the last run can hold expired
+    // timers; after a long gap that is the whole wheel
+    uint32_t ticks = (now - cursor_ms) / SCHED_TICK_MS + 1;
+    if (ticks > SCHED_WHEEL_SLOTS) ticks = SCHED_WHEEL_SLOTS;
+    for (uint32_t i = 0; i < ticks; i++) {
+        SchedTimer **head = slot_for(cursor_ms + i * SCHED_TICK_MS);
+        for (SchedTimer *t = *head, *next; t; t = next) {
+            next = t->next;
+            if (!is_due(t->due_ms, now)) continue;   // a later turn of the wheel
+            unlink(*t);
+            link(&ready, *t);
+        }
+    }
+    cursor_ms = now - now % SCHED_TICK_MS;
+
+    // callbacks run unlocked and may arm or stop any timer, this one included
+    while (ready) {
+        SchedTimer &t = *ready;
+        unlink(t);
+        uint32_t late = now - t.due_ms;
+        if (late > stats.max_late_ms) stats.max_late_ms = late;
+        stats.fired++;
+        sched_fn fn = t.fn;
+        void *arg = t.arg;
+        if (t.period_ms) {
+            // keep the phase unless we fell a whole period behind
+            t.due_ms += t.period_ms;
+            if (is_due(t.due_ms, now)) t.due_ms = now + t.period_ms;
+            link(slot_for(t.due_ms), t);
+        }
+        critical_section_exit(&lock);
+        fn(arg);
+        critical_section_enter_blocking(&lock);
+    }
+
+    now = now_ms();
+    uint32_t next = UINT32_MAX;
+    for (SchedTimer *head : wheel) {
+        for (SchedTimer *t = head; t; t = t->next) {
+            int32_t d = (int32_t)(t->due_ms - now);
+            uint32_t wait = d > 0 ? (uint32_t)d : 0;
+            if (wait < next) next = wait;
+        }
+    }
+    critical_section_exit(&lock);
+    return next;
+}
+
+void sched_set_wake(void (*wake)(void)) {
+    wake_fn = wake;
+}
+
+void sched_wake() {
+    if (wake_fn) wake_fn();
+}
+
+const SchedStats &sched_stats() {
+    return stats;
+}
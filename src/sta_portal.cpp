@@ -1,10 +1,29 @@
-#include "lwip/tcp.h"
+#include "http_router.h"
 #include "creds_store.h"
-#include "hardware/watchdog.h"
+#include "creds_json.h"
+#include "pico_captive_connect.h"
+#include "scheduler.h"
 #include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "lwip/netif.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+
+#ifndef STA_EVENTS_INTERVAL_MS
+// default /events period; ?ms= picks another within the limits below
+#define STA_EVENTS_INTERVAL_MS 1000
+#endif
+#define STA_EVENTS_MIN_MS 250
+// an unacked stream is reaped after HTTP_IDLE_TIMEOUT_S, so stay well inside it
+#define STA_EVENTS_MAX_MS 10000
+
+#ifndef STA_EVENTS_MAX_CLIENTS
+// each stream holds a connection slot for as long as the page is open
+#define STA_EVENTS_MAX_CLIENTS 2
+#endif
 
 
 
@@ -22,25 +41,6 @@ static struct netif *get_sta_netif() {
     return nullptr;
 }
 
-static const char *PAGE =
-"HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n"
-"<!doctype html><html><body style='font-family:sans-serif'>"
-"<h2>Pico Device Configuration</h2>"
-"<p>Device is connected to Wi-Fi.</p>"
-"<form method='POST' action='/save_mqtt'>"
-"MQTT Host:<br><input name='h' maxlength='63'><br>"
-"Port:<br><input name='o' maxlength='5'><br>"
-"Username:<br><input name='u' maxlength='31'><br>"
-"Password:<br><input name='w' type='password' maxlength='31'><br><br>"
-"Device Hostname:<br><input name='n' maxlength='31'><br><br>"
-"<button type='submit'>Save & Reboot</button>"
-"</form><br>"
-"<form method='POST' action='/reprovision'>"
-"<button type='submit'>Re-Provision Wi-Fi</button>"
-"</form>"
-"</body></html>";
-
-
 // static void send_config_page(struct tcp_pcb *tpcb) {
 //     DeviceCreds c{};
 //     creds_load(c);  // load saved creds (if any)
@@ -74,65 +74,62 @@ static const char *PAGE =
 //     tcp_write(tpcb, page, strlen(page), TCP_WRITE_FLAG_COPY);
 // }
 
-static void send_config_page(struct tcp_pcb *tpcb) {
-    DeviceCreds c{};
-    creds_load(c);  // load saved creds (if any)
-
-    // --- Build HTML body dynamically ---
-    char body[1024];
-    int body_len = snprintf(body, sizeof(body),
-        "<!doctype html><html><body style='font-family:sans-serif'>"
-        "<h2>Pico Device Configuration</h2>"
-        "<p>Device is connected to Wi-Fi.</p>"
-        "<form method='POST' action='/save_mqtt'>"
-        "MQTT Host:<br><input name='h' maxlength='63' value='%s'><br>"
-        "Port:<br><input name='o' maxlength='5' value='%d'><br>"
-        "Username:<br><input name='u' maxlength='31' value='%s'><br>"
-        "Password:<br><input name='w' type='password' maxlength='31' value=''><br><br>"
-        "Device Hostname:<br><input name='n' maxlength='31' value='%s'><br><br>"
-        "<button type='submit'>Save & Reboot</button>"
-        "</form><br>"
-        "<form method='POST' action='/reprovision'>"
-        "<button type='submit'>Re-Provision Wi-Fi</button>"
-        "</form>"
-        "</body></html>",
-        c.mqtt_host[0] ? c.mqtt_host : "",
-        c.mqtt_port ? c.mqtt_port : 1883,   // default to 1883 if not set
-        c.mqtt_user[0] ? c.mqtt_user : "",
-        c.hostname[0] ? c.hostname : "pico-device"
-    );
-
-    if (body_len < 0 || body_len >= (int)sizeof(body)) {
-        printf("send_config_page: body truncated!\n");
-        return;
+enum ConfigField : uint8_t {
+    F_MQTT_HOST,
+    F_MQTT_PORT,
+    F_MQTT_USER,
+    F_HOSTNAME,
+};
+
+static const TplPart CONFIG_PAGE[] = {
+    TPL_TEXT("<!doctype html><html><head><meta name='viewport' content='width=device-width, initial-scale=1'>"
+             "<link rel='stylesheet' href='/portal.css'></head><body>"
+             "<h2>Pico Device Configuration</h2>"
+             "<p>Device is connected to Wi-Fi.</p>"
+             "<form method='POST' action='/save_mqtt'>"
+             "MQTT Host:<br><input name='h' maxlength='63' value='"),
+    TPL_FIELD(F_MQTT_HOST),
+    TPL_TEXT("'><br>Port:<br><input name='o' maxlength='5' value='"),
+    TPL_FIELD(F_MQTT_PORT),
+    TPL_TEXT("'><br>Username:<br><input name='u' maxlength='31' value='"),
+    TPL_FIELD(F_MQTT_USER),
+    TPL_TEXT("'><br>Password:<br><input name='w' type='password' maxlength='31' value=''><br><br>"
+             "Device Hostname:<br><input name='n' maxlength='31' value='"),
+    TPL_FIELD(F_HOSTNAME),
+    TPL_TEXT("'><br><br>"
+             "<button type='submit'>Save & Reboot</button>"
+             "</form><br>"
+             "<form method='POST' action='/reprovision'>"
+             "<button type='submit'>Re-Provision Wi-Fi</button>"
+             "</form>"
+             "</body></html>"),
+    TPL_END,
+};
+
+static const char *config_value(const void *ctx, uint8_t field, char *scratch, size_t size) {
+    const DeviceCreds &c = *(const DeviceCreds*)ctx;
+    switch (field) {
+    case F_MQTT_HOST: return c.mqtt_host;
+    case F_MQTT_PORT:
+        snprintf(scratch, size, "%d", c.mqtt_port ? c.mqtt_port : 1883);   // default to 1883 if not set
+        return scratch;
+    case F_MQTT_USER: return c.mqtt_user;
+    case F_HOSTNAME:  return c.hostname[0] ? c.hostname : "pico-device";
+    default:          return "";
     }
-
-    // --- Build HTTP header with Content-Length ---
-    char header[128];
-    int header_len = snprintf(header, sizeof(header),
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: text/html\r\n"
-        "Content-Length: %d\r\n"
-        "Connection: close\r\n\r\n",
-        body_len
-    );
-
-    if (header_len < 0 || header_len >= (int)sizeof(header)) {
-        printf("send_config_page: header truncated!\n");
-        return;
-    }
-
-    // --- Send header and body ---
-    tcp_write(tpcb, header, header_len, TCP_WRITE_FLAG_COPY);
-    tcp_write(tpcb, body, body_len, TCP_WRITE_FLAG_COPY);
-    tcp_output(tpcb);
 }
 
+// The page renders over several ACKs, so it needs a copy that outlives the
+// request; one per connection, as each page streams at its own pace
+static DeviceCreds config_snapshots[HTTP_MAX_CONNS];
 
-
+static void send_config_page(HttpConn *conn) {
+    DeviceCreds &snap = config_snapshots[http_conn_index(conn)];
+    snap = creds_get();
+    http_send_template(conn, 200, "text/html", CONFIG_PAGE, config_value, &snap);
+}
 
 static const char *OK =
-"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n"
 "Rebooting into AP/Provisioning mode...\n";
 
 static void url_decode(char *s) {
@@ -146,16 +143,21 @@ static void url_decode(char *s) {
     *w=0;
 }
 
-static void parse_and_save_mqtt(const char *body, size_t len){
+// Reboot once the new creds are in flash (runs from net_task(), not lwIP)
+static void reboot_after_save(bool ok, void *arg) {
+    (void)arg;
+    if (!ok) printf("STA HTTP: saving creds failed\n");
+    net_schedule_reboot(500);
+}
+
+// False if the save couldn't be queued
+static bool parse_and_save_mqtt(const char *body, size_t len){
 
-    char buf[300]; if (len >=sizeof(buf)) len = sizeof(buf)-1;
+    char buf[HTTP_MAX_BODY + 1]; if (len >= sizeof(buf)) len = sizeof(buf)-1;
 
     memcpy(buf,body,len); buf[len]=0;
 
-    DeviceCreds c{};
-    if (!creds_load(c)) {
-        memset(&c,0, sizeof(c));
-    }
+    DeviceCreds c = creds_get();
 
     char *tok =strtok(buf, "&");
     while (tok){
@@ -169,77 +171,236 @@ static void parse_and_save_mqtt(const char *body, size_t len){
 
     c.valid = true;
     printf("Saving MQTT creds: HOST='%s', PORT=%d, USER='%s', Device Hostname='%s'\n", c.mqtt_host, c.mqtt_port, c.mqtt_user, c.hostname);
-    creds_save(c);
+    if (!creds_save_async(c, false, reboot_after_save, nullptr)) return false;
+    sched_wake();
+    return true;
+}
+
 
+static void on_config_page(HttpConn *c, const HttpRequest &req) {
+    (void)req;
+    send_config_page(c);
 }
 
+static void on_save_mqtt(HttpConn *c, const HttpRequest &req) {
+    if (!parse_and_save_mqtt(req.body, req.body_len)) {
+        http_send_status(c, 503);
+        return;
+    }
+    http_send_response(c, 200, "text/plain", OK, strlen(OK));
+}
 
-static err_t on_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
-    (void)arg; (void)len;
-    tcp_close(tpcb);
-    return ERR_OK;
+// GET: current settings, PUT: replace them in one go and reboot
+static void on_api_config(HttpConn *c, const HttpRequest &req) {
+    if (req.method == HTTP_PUT) {
+        DeviceCreds n = creds_get();
+        char err[64];
+        int status = creds_json_apply(n, req.body, req.body_len, err, sizeof(err));
+        if (status) {
+            http_send_json_error(c, status, err);
+            return;
+        }
+        // clearing the Wi-Fi creds is /reprovision's job
+        if (!n.valid) {
+            http_send_json_error(c, 400, "ssid: required");
+            return;
+        }
+        if (!creds_save_async(n, false, reboot_after_save, nullptr)) {
+            http_send_json_error(c, 503, "save already pending");
+            return;
+        }
+        sched_wake();
+        char buf[48];
+        JsonWriter w;
+        json_init(w, buf, sizeof(buf));
+        json_object_begin(w);
+        json_bool(w, "saved", true);
+        json_bool(w, "reboot", true);
+        json_object_end(w);
+        http_send_json(c, 200, w);
+        return;
+    }
+    char buf[384];
+    JsonWriter w;
+    json_init(w, buf, sizeof(buf));
+    creds_json_write(w, creds_get());
+    http_send_json(c, 200, w);
 }
 
-static err_t on_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
-    (void)arg; (void)err;
+static void on_api_status(HttpConn *c, const HttpRequest &req) {
+    (void)req;
+    char buf[384];
+    JsonWriter w;
+    json_init(w, buf, sizeof(buf));
+    json_object_begin(w);
+    json_string(w, "mode", "sta");
+    json_string(w, "hostname", net_hostname());
+    json_string(w, "ip", ipaddr_ntoa(&c->pcb->local_ip));
+    json_bool(w, "wifi", net_is_connected());
+    json_bool(w, "mqtt", mqtt_is_connected());
+    json_uint(w, "uptime_s", to_ms_since_boot(get_absolute_time()) / 1000);
+    json_uint(w, "config_generation", creds_generation());
+    // how the last connect went, see NetStaStats
+    const NetStaStats &st = net_sta_stats();
+    json_object_begin(w, "connect");
+    json_uint(w, "boot_to_ip_ms", st.boot_to_ip_ms);
+    json_uint(w, "join_ms", st.last_join_ms);
+    json_uint(w, "dhcp_ms", st.last_dhcp_ms);
+    json_uint(w, "fast_joins", st.fast_joins);
+    json_uint(w, "fast_join_misses", st.fast_join_misses);
+    json_uint(w, "leases_reused", st.leases_reused);
+    json_object_end(w);
+    json_object_end(w);
+    http_send_json(c, 200, w);
+}
 
-    if (!p) {               // remote closed
-        tcp_close(tpcb);
-        return ERR_OK;
+// ---- /events: telemetry as Server-Sent Events ----
+//
+// Every stream renders the latest snapshot when it has room for it. A client
+// that reads slowly keeps its send buffer full and simply skips snapshots, so
+// nothing queues up on our side; one that stops reading is reaped as stalled.
+
+static SchedTimer events_tick;
+static SchedTimer events_news;          // MQTT state changed
+static HttpServer *events_server;
+static uint32_t events_seq = 1;         // streams start at 0, so they send at once
+static uint32_t events_interval_ms = STA_EVENTS_INTERVAL_MS;
+
+#if MEMP_STATS
+struct PoolName {
+    const char *name;
+    memp_t pool;
+};
+
+static const PoolName event_pools[] = {
+    {"tcp_pcb",     MEMP_TCP_PCB},
+    {"tcp_seg",     MEMP_TCP_SEG},
+    {"pbuf_pool",   MEMP_PBUF_POOL},
+    {"sys_timeout", MEMP_SYS_TIMEOUT},
+};
+#endif
+
+// One event, or 0 if it doesn't fit in room
+static size_t render_event(HttpConn *c, char *buf, size_t room) {
+    static const char head[] = "event: telemetry\ndata: ";
+    static const char retry[] = "retry: 3000\n";
+    size_t pre = c->stream_pos ? 0 : sizeof(retry) - 1;
+    if (room < pre + sizeof(head) - 1 + 2) return 0;
+    memcpy(buf, retry, pre);
+    memcpy(buf + pre, head, sizeof(head) - 1);
+    pre += sizeof(head) - 1;
+
+    const NetTelemetry &t = net_telemetry();
+    JsonWriter w;
+    json_init(w, buf + pre, room - pre - 2);
+    json_object_begin(w);
+    json_uint(w, "t_ms", to_ms_since_boot(get_absolute_time()));
+    json_int(w, "rssi", t.rssi);
+    json_bool(w, "wifi", net_is_connected());
+    json_string(w, "mqtt", mqtt_state_name());
+    json_uint(w, "mqtt_connects", t.mqtt_connects);
+    json_uint(w, "mqtt_drops", t.mqtt_drops);
+    json_uint(w, "pub_ok", t.pub_ok);
+    json_uint(w, "pub_failed", t.pub_failed);
+    json_uint(w, "pub_err_mem", t.pub_err_mem);
+    json_uint(w, "pub_busy", t.pub_busy);
+    json_uint(w, "http_active", c->server->stats.active);
+#if MEMP_STATS
+    // [used, max, available, allocation failures]
+    json_object_begin(w, "pools");
+    for (const PoolName &p : event_pools) {
+        const struct stats_mem *m = lwip_stats.memp[p.pool];
+        json_array_begin(w, p.name);
+        json_uint(w, nullptr, m->used);
+        json_uint(w, nullptr, m->max);
+        json_uint(w, nullptr, m->avail);
+        json_uint(w, nullptr, m->err);
+        json_array_end(w);
     }
+    json_object_end(w);
+#endif
+    json_object_end(w);
+    if (w.overflow) return 0;
+    memcpy(buf + pre + w.len, "\n\n", 2);
+    return pre + w.len + 2;
+}
 
-    // Inform lwIP we've received this data
-    tcp_recved(tpcb, p->tot_len);
+static size_t events_stream(HttpConn *c, char *buf, size_t room) {
+    if (c->stream_pos == events_seq) return HTTP_STREAM_IDLE;
+    size_t n = render_event(c, buf, room);
+    // too little send buffer: the next ACK calls again
+    if (!n) return HTTP_STREAM_IDLE;
+    c->stream_pos = events_seq;
+    return n;
+}
 
-    char req[1024];
-    size_t n = pbuf_copy_partial(p, req, sizeof(req)-1, 0);
-    req[n] = 0;
+// Runs from net_task(), so lwIP has to be locked around the writes
+static void events_publish(void *arg) {
+    (void)arg;
+    net_telemetry_sample();
+    events_seq++;
+    cyw43_arch_lwip_begin();
+    uint16_t open = http_stream_kick(*events_server, events_stream);
+    cyw43_arch_lwip_end();
+    if (!open) {
+        sched_timer_stop(events_tick);
+        net_telemetry_watch(nullptr, nullptr, nullptr);
+    }
+}
 
-    // printf("STA HTTP on_recv (len=%u):\n%.*s\n", (unsigned)p->tot_len, (int)n, req);
+static void on_events(HttpConn *c, const HttpRequest &req) {
+    if (http_stream_count(*c->server, events_stream) >= STA_EVENTS_MAX_CLIENTS) {
+        http_send_status(c, 503);
+        return;
+    }
+    // ?ms=N sets the period for every open stream
+    const char *q = strstr(req.query, "ms=");
+    if (q && (q == req.query || q[-1] == '&')) {
+        long ms = strtol(q + 3, nullptr, 10);
+        if (ms < STA_EVENTS_MIN_MS) ms = STA_EVENTS_MIN_MS;
+        if (ms > STA_EVENTS_MAX_MS) ms = STA_EVENTS_MAX_MS;
+        events_interval_ms = ms;
+    }
+    events_server = c->server;
+    if (!http_send_stream(c, 200, "text/event-stream", events_stream, "Cache-Control: no-store\r\n")) return;
+    sched_timer_start(events_tick, events_interval_ms, events_interval_ms, events_publish, nullptr);
+    net_telemetry_watch(&events_news, events_publish, nullptr);
+}
 
-    if (!strncmp(req, "GET / ", 6)) {
-        // tcp_write(tpcb, PAGE, strlen(PAGE), TCP_WRITE_FLAG_COPY);
-        send_config_page(tpcb);
-    } else if (!strncmp(req, "POST /save_mqtt", 15)) {
-        const char *body = strstr(req, "\r\n\r\n");
-        if (body) {
-            body += 4;
-            parse_and_save_mqtt(body, strlen(body));
-        }
-        tcp_write(tpcb, OK, strlen(OK), TCP_WRITE_FLAG_COPY);
-        tcp_output(tpcb);
-        pbuf_free(p);
-
-        sleep_ms(500);
-        watchdog_reboot(0, 0, 0);
-        return ERR_OK;
-    } else if (!strncmp(req, "POST /reprovision", 17)) {
-        DeviceCreds empty{}; empty.valid = false;
-        creds_save(empty);
-        tcp_write(tpcb, OK, strlen(OK), TCP_WRITE_FLAG_COPY);
-        tcp_output(tpcb);
-        pbuf_free(p);
-        sleep_ms(500);
-        watchdog_reboot(0, 0, 0);
-        return ERR_OK;
-    } else {
-        tcp_write(tpcb, PAGE, strlen(PAGE), TCP_WRITE_FLAG_COPY);
+static void on_reprovision(HttpConn *c, const HttpRequest &req) {
+    (void)req;
+    DeviceCreds empty{}; empty.valid = false;
+    if (!creds_save_async(empty, false, reboot_after_save, nullptr)) {
+        http_send_status(c, 503);
+        return;
     }
+    sched_wake();
+    http_send_response(c, 200, "text/plain", OK, strlen(OK));
+}
 
-    tcp_output(tpcb);
-    pbuf_free(p);
-    return ERR_OK;
+static void on_other(HttpConn *c, const HttpRequest &req) {
+    if (const WebAsset *a = web_asset_find(req.path)) http_send_asset(c, *a);
+    else http_send_status(c, 404);
 }
 
-static err_t on_accept(void *arg, struct tcp_pcb *newpcb, err_t err) {
-    (void)arg; (void)err;
-    printf("STA HTTP: connection accepted from %s\n", ipaddr_ntoa(&newpcb->remote_ip));
-    tcp_recv(newpcb, on_recv);
-    tcp_sent(newpcb, on_sent);
-    return ERR_OK;
+static constexpr HttpRoute ROUTES[] = {
+    {"/",               HTTP_M_GET,         on_config_page},
+    {"/api/config",     HTTP_M_GET | HTTP_M(HTTP_PUT), on_api_config},
+    {"/api/status",     HTTP_M_GET,         on_api_status},
+    {"/events",         HTTP_M(HTTP_GET),   on_events},
+    {"/reprovision",    HTTP_M(HTTP_POST),  on_reprovision},
+    {"/save_mqtt",      HTTP_M(HTTP_POST),  on_save_mqtt},
+};
+HTTP_ROUTER(router, "STA HTTP", ROUTES, on_other);
+
+static void on_request(HttpConn *c, const HttpRequest &req) {
+    http_route(router, c, req);
 }
 
+static HttpServer server = {"STA HTTP", on_request, nullptr};
+
 void sta_http_start(void) {
+    if (server.listen_pcb) return;
     struct netif *nif = get_sta_netif();
     if (!nif) {
         printf("STA HTTP: no STA netif found!\n");
@@ -251,23 +412,18 @@ void sta_http_start(void) {
         netif_set_up(nif);
     }
 
-    ip4_addr_t ip = *netif_ip4_addr(nif);
-    printf("STA HTTP: binding to IP %s\n", ip4addr_ntoa(&ip));
+    const ip_addr_t *ip = netif_ip_addr4(nif);
+    printf("STA HTTP: binding to IP %s\n", ipaddr_ntoa(ip));
 
-    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_V4);
-    if (!pcb) {
-        printf("STA HTTP: tcp_new failed\n");
-        return;
-    }
+    if (!http_server_start(server, ip, 80)) return;
+    printf("STA HTTP server started at %s:80\n", ipaddr_ntoa(ip));
+}
 
-    err_t e = tcp_bind(pcb, &ip, 80);
-    if (e != ERR_OK) {
-        printf("STA HTTP: tcp_bind failed err=%d\n", e);
-        tcp_close(pcb);
-        return;
-    }
+void sta_http_stop(void) {
+    http_server_stop(server);
+}
 
-    pcb = tcp_listen_with_backlog(pcb, 2);
-    tcp_accept(pcb, on_accept);
-    printf("STA HTTP server started at %s:80\n", ip4addr_ntoa(&ip));
-}
\ No newline at end of file
+void sta_http_print_stats(void) {
+    http_server_print_stats(server);
+    http_router_print_stats(router);
+}
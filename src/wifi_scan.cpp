@@ -0,0 +1,133 @@
+#include "wifi_scan.h"
+#include "scheduler.h"
+#include "pico/cyw43_arch.h"
+#include "pico/time.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIFI_SCAN_POLL_MS
+// a full pass over 2.4 GHz takes a couple of seconds
+#define WIFI_SCAN_POLL_MS 250
+#endif
+
+static WifiScanTable results;           // last completed scan
+static WifiScanTable pending;           // filled by the driver while scanning
+static bool scanning;
+static SchedTimer scan_timer;
+static SchedTimer poll_timer;
+
+// One entry per SSID, the strongest BSS wins; a full table drops its weakest
+static void table_add(WifiScanTable &t, const cyw43_ev_scan_result_t &r) {
+    WifiNetwork *slot = nullptr;
+    for (uint8_t i = 0; i < t.count; i++) {
+        WifiNetwork &n = t.nets[i];
+        if (strlen(n.ssid) == r.ssid_len && !memcmp(n.ssid, r.ssid, r.ssid_len)) {
+            if (r.rssi <= n.rssi) return;
+            slot = &n;
+            break;
+        }
+    }
+    if (!slot && t.count < WIFI_SCAN_MAX) slot = &t.nets[t.count++];
+    if (!slot) {
+        WifiNetwork *weakest = &t.nets[0];
+        for (uint8_t i = 1; i < t.count; i++) {
+            if (t.nets[i].rssi < weakest->rssi) weakest = &t.nets[i];
+        }
+        if (r.rssi <= weakest->rssi) return;
+        slot = weakest;
+    }
+    memcpy(slot->ssid, r.ssid, r.ssid_len);
+    slot->ssid[r.ssid_len] = '\0';
+    memcpy(slot->bssid, r.bssid, sizeof(slot->bssid));
+    slot->rssi = r.rssi;
+    slot->channel = (uint8_t)r.channel;
+    slot->auth = r.auth_mode;
+}
+
+// Driver callback, one call per beacon/probe response heard
+static int on_result(void *env, const cyw43_ev_scan_result_t *r) {
+    (void)env;
+    // hidden networks can't be picked by name
+    if (r && r->ssid_len && r->ssid_len <= 32 && r->ssid[0]) table_add(pending, *r);
+    return 0;
+}
+
+static void sort_by_rssi(WifiScanTable &t) {
+    for (uint8_t i = 1; i < t.count; i++) {
+        WifiNetwork n = t.nets[i];
+        uint8_t j = i;
+        for (; j > 0 && t.nets[j - 1].rssi < n.rssi; j--) t.nets[j] = t.nets[j - 1];
+        t.nets[j] = n;
+    }
+}
+
+static void scan_poll(void *arg) {
+    (void)arg;
+    cyw43_arch_lwip_begin();
+    bool active = cyw43_wifi_scan_active(&cyw43_state);
+    if (!active) {
+        sort_by_rssi(pending);
+        pending.generation = results.generation + 1;
+        pending.updated_ms = to_ms_since_boot(get_absolute_time());
+        results = pending;
+        scanning = false;
+    }
+    cyw43_arch_lwip_end();
+    if (active) {
+        sched_timer_start(poll_timer, WIFI_SCAN_POLL_MS, 0, scan_poll, nullptr);
+        return;
+    }
+    printf("[SCAN] %u networks\n", results.count);
+}
+
+static void scan_begin(void *arg) {
+    (void)arg;
+    if (scanning) return;
+    cyw43_wifi_scan_options_t opts = {};
+    int err = 0;
+    cyw43_arch_lwip_begin();
+    // the driver runs one scan at a time; one still going from before a
+    // stop is reporting into pending already, so just wait for it
+    if (cyw43_wifi_scan_active(&cyw43_state)) {
+        scanning = true;
+    } else {
+        pending.count = 0;
+        err = cyw43_wifi_scan(&cyw43_state, &opts, nullptr, on_result);
+        scanning = err == 0;
+    }
+    cyw43_arch_lwip_end();
+    if (err) printf("[SCAN] start failed: %d\n", err);
+    if (scanning) sched_timer_start(poll_timer, WIFI_SCAN_POLL_MS, 0, scan_poll, nullptr);
+}
+
+void wifi_scan_start() {
+    sched_timer_start(scan_timer, 0, WIFI_SCAN_INTERVAL_MS, scan_begin, nullptr);
+}
+
+void wifi_scan_request() {
+    // only while the periodic scan is on, i.e. in AP mode
+    if (sched_timer_armed(scan_timer) && !scanning) wifi_scan_start();
+}
+
+void wifi_scan_stop() {
+    sched_timer_stop(scan_timer);
+    sched_timer_stop(poll_timer);
+    scanning = false;
+}
+
+bool wifi_scan_busy() {
+    return scanning;
+}
+
+const WifiScanTable &wifi_scan_results() {
+    return results;
+}
+
+const char *wifi_auth_name(uint8_t auth) {
+    // bit 0 WEP, bit 1 WPA, bit 2 WPA2
+    if ((auth & 6) == 6) return "wpa/wpa2";
+    if (auth & 4) return "wpa2";
+    if (auth & 2) return "wpa";
+    if (auth & 1) return "wep";
+    return "open";
+}